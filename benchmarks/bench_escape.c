@@ -0,0 +1,64 @@
+#include "slog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PAYLOAD_LEN 4096
+#define ROUNDS 20000
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void fill_ascii(char *buf, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = 'a' + (char)(i % 26);
+	}
+}
+
+static void fill_utf8(char *buf, size_t len) {
+	static const char *glyph = "\xe4\xb8\x96\xe7\x95\x8c\xc3\xa9"; // 世界é
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = glyph[i % 8];
+	}
+}
+
+static void fill_escapes(char *buf, size_t len) {
+	static const char *pattern = "a\"b\\c\nd\te\x01";
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = pattern[i % 10];
+	}
+}
+
+static void run(const char *name, void (*fill)(char *, size_t)) {
+	char *payload = malloc(PAYLOAD_LEN + 1);
+	fill(payload, PAYLOAD_LEN);
+	payload[PAYLOAD_LEN] = '\0';
+
+	// warm up the buffer so growth is not measured
+	slog_write_escape_n(payload, PAYLOAD_LEN);
+	slog_buffer.index = 0;
+
+	double start = now_ns();
+	for (int i = 0; i < ROUNDS; i++) {
+		slog_write_escape_n(payload, PAYLOAD_LEN);
+		slog_buffer.index = 0;
+	}
+	double elapsed = now_ns() - start;
+
+	printf("%-12s %8.3f ns/byte\n", name,
+	       elapsed / ((double)ROUNDS * PAYLOAD_LEN));
+	free(payload);
+}
+
+int main(void) {
+	run("ascii", fill_ascii);
+	run("utf8", fill_utf8);
+	run("escapes", fill_escapes);
+
+	SLOG_FREE();
+	return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+
+static unsigned long long allocations = 0;
+
+static void *counting_malloc(size_t size) {
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return malloc(size);
+}
+
+static void *counting_calloc(size_t n, size_t size) {
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return calloc(n, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return realloc(ptr, size);
+}
+
+// count every allocation slog.h makes
+#define malloc(size) counting_malloc(size)
+#define calloc(n, size) counting_calloc(n, size)
+#define realloc(ptr, size) counting_realloc(ptr, size)
+
+#include "slog.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORDS 200000
+#define MAX_THREADS 16
+
+static FILE *report = NULL;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void null_handler(const char *str) {
+	(void)str;
+}
+
+static size_t record_bytes = 0;
+
+static void measure_handler(const char *str) {
+	record_bytes = strlen(str) + 1; // stdout adds the newline
+}
+
+static void log_message(int i) {
+	(void)i;
+	SLOG(SLOG_INFO, "request done");
+}
+
+static void log_scalars(int i) {
+	SLOG(SLOG_INFO, "request done", SLOG_INT("user_id", i),
+	     SLOG_STRING("method", "GET"), SLOG_INT("status", 200),
+	     SLOG_FLOAT("latency", 0.25), SLOG_BOOL("cached", true));
+}
+
+static void log_nested(int i) {
+	SLOG(SLOG_INFO, "request done",
+	     SLOG_OBJECT("user", SLOG_INT("id", i), SLOG_STRING("name", "qaq"),
+			 SLOG_OBJECT("geo", SLOG_FLOAT("lat", 52.52),
+				     SLOG_FLOAT("lon", 13.40))),
+	     SLOG_ARRAY("tags", SLOG_STRING(NULL, "a"), SLOG_STRING(NULL, "b"),
+			SLOG_INT(NULL, 3)));
+}
+
+static void log_escapes(int i) {
+	SLOG(SLOG_INFO, "path \"C:\\tmp\"\n", SLOG_INT("i", i),
+	     SLOG_STRING("query", "name=\"x\"\tand\\y\x01\n\"quoted\""),
+	     SLOG_STRING("utf8", "\xe4\xb8\x96\xe7\x95\x8c \"ok\""));
+}
+
+static void log_filtered(int i) {
+	SLOG(SLOG_DEBUG, "filtered", SLOG_INT("i", i));
+}
+
+struct scenario {
+	const char *name;
+	void (*log)(int i);
+};
+
+struct worker {
+	void (*log)(int i);
+	int records;
+};
+
+static void *run_worker(void *arg) {
+	const struct worker *w = (const struct worker *)arg;
+	for (int i = 0; i < w->records; i++) {
+		w->log(i);
+	}
+	SLOG_FREE();
+	return NULL;
+}
+
+static void run(const char *name, const char *output,
+		void (*log)(int i), int threads) {
+	// one record through a measuring handler gives the output size
+	SLOG_SET_HANDLER(measure_handler);
+	record_bytes = 0;
+	log(0);
+	if (output) {
+		SLOG_SET_HANDLER(null_handler);
+	} else {
+		SLOG_RESET();
+		SLOG_SET_LEVEL(SLOG_INFO);
+	}
+
+	// warm up the pools, buffers and caches of this thread
+	for (int i = 0; i < 1000; i++) {
+		log(i);
+	}
+
+	struct worker w = {log, RECORDS / threads};
+	pthread_t tids[MAX_THREADS];
+	const unsigned long long allocs_before = allocations;
+	const double start = now_ns();
+	if (threads == 1) {
+		for (int i = 0; i < w.records; i++) {
+			log(i);
+		}
+	} else {
+		for (int t = 0; t < threads; t++) {
+			pthread_create(&tids[t], NULL, run_worker, &w);
+		}
+		for (int t = 0; t < threads; t++) {
+			pthread_join(tids[t], NULL);
+		}
+	}
+	const double elapsed = now_ns() - start;
+	const double records = (double)w.records * threads;
+
+	fprintf(report, "%-10s %-7s %7d %11.1f %9.1f %13.3f\n", name,
+		output ? output : "stdout", threads, elapsed / records,
+		(double)record_bytes * records / elapsed * 1e3,
+		(double)(allocations - allocs_before) / records);
+}
+
+// bench_record [THREADS]: thread scaling goes up to THREADS, default the
+// number of online CPUs
+int main(int argc, char **argv) {
+	// records go to /dev/null, the report to the original stdout
+	report = fdopen(dup(STDOUT_FILENO), "w");
+	if (!report || !freopen("/dev/null", "w", stdout)) {
+		return 1;
+	}
+	SLOG_SET_LEVEL(SLOG_INFO);
+
+	const struct scenario scenarios[] = {
+		{"message", log_message}, {"scalars", log_scalars},
+		{"nested", log_nested},   {"escapes", log_escapes},
+		{"filtered", log_filtered},
+	};
+	fprintf(report, "%-10s %-7s %7s %11s %9s %13s\n", "scenario",
+		"output", "threads", "ns/record", "MB/s", "allocs/record");
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		run(scenarios[i].name, "null", scenarios[i].log, 1);
+		run(scenarios[i].name, NULL, scenarios[i].log, 1);
+	}
+
+	long cpus = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	cpus = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : cpus;
+	for (int threads = 2; threads <= cpus; threads *= 2) {
+		run("scalars", "null", log_scalars, threads);
+		run("scalars", NULL, log_scalars, threads);
+	}
+
+	SLOG_FREE();
+	fclose(report);
+	return 0;
+}
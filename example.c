@@ -36,11 +36,9 @@ int main() {
 	SLOG_SET_HANDLER(eprintf);
 	SLOG(SLOG_DEBUG, "custom output handler");
 
-#define MYLOG(MSG, ...)                                                        \
-	SLOG(SLOG_INFO, MSG, SLOG_INT("user_id", id), ##__VA_ARGS__)
-
-	MYLOG("log from sub-logger");
-#undef MYLOG
+	struct slog_logger *sub = SLOG_LOGGER(NULL, SLOG_INT("user_id", id));
+	SLOG_WITH(sub, SLOG_INFO, "log from sub-logger");
+	SLOG_LOGGER_FREE(sub);
 
 	SLOG_FREE();
 	return 0;
@@ -8,14 +8,28 @@
 #define SLOG_H
 
 #include <assert.h>
+#include <errno.h>
+#include <float.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #if defined(__cplusplus)
 #define SLOG_THREAD_LOCAL thread_local
@@ -35,6 +49,61 @@ enum slog_level {
 	SLOG_LAST
 };
 
+static const char *const slog_level_names[SLOG_LAST] = {
+	"ERROR",
+	"WARN",
+	"INFO",
+	"DEBUG",
+};
+
+// Calls above this level are compiled out. Define it before including
+// slog.h, e.g. -DSLOG_MIN_LEVEL=SLOG_INFO for release builds.
+#ifndef SLOG_MIN_LEVEL
+#define SLOG_MIN_LEVEL SLOG_DEBUG
+#endif
+
+// Name matched by SLOG_LEVELS entries in addition to the path components
+// of __FILE__. Define it before including slog.h.
+#ifndef SLOG_MODULE
+#define SLOG_MODULE NULL
+#endif
+
+// Duplicate suppression state of a callsite, see SLOG_SET_DEDUP. Times
+// are record times in nanoseconds.
+struct slog_callsite;
+struct slog_dedup {
+	uint64_t hash;   // body of the last record written in full
+	long long start; // its time, which opens the window
+	long long first; // first and last suppressed repeat
+	long long last;
+	unsigned long long repeats;
+	struct slog_callsite *next; // pending summaries
+	bool queued;
+	bool lock;
+};
+
+// Fixed part of every record, one static instance per SLOG expansion.
+struct slog_callsite {
+	const char *file;
+	const char *func;
+	int line;
+	enum slog_level level;
+	const char *module;
+
+	// `{"file":...,"level":"...","time":`, serialized on first use
+	const char *prefix;
+	size_t prefix_len;
+
+	// configuration generation << 1 | enabled, 0 until first resolved
+	unsigned enabled;
+
+	struct slog_dedup dedup;
+};
+
+#define SLOG_CALLSITE_INIT(LEVEL)                                              \
+	{__FILE__, __func__, __LINE__, LEVEL, SLOG_MODULE, NULL, 0, 0,         \
+	 {0, 0, 0, 0, 0, NULL, false, false}}
+
 enum slog_type {
 	SLOG_TYPE_STRING = 1,
 	SLOG_TYPE_INT,
@@ -43,6 +112,9 @@ enum slog_type {
 	SLOG_TYPE_TIME,
 	SLOG_TYPE_ARRAY,
 	SLOG_TYPE_OBJECT,
+	SLOG_TYPE_STRING_N, // text, escaped
+	SLOG_TYPE_TRUSTED,  // string written without escaping
+	SLOG_TYPE_RAW,      // text copied verbatim, must be valid JSON
 };
 
 struct slog_node {
@@ -58,25 +130,283 @@ struct slog_node {
 		struct timespec time;
 		struct slog_node *array;
 		struct slog_node *object;
+		struct {
+			const char *data;
+			size_t len;
+		} text;
+		// array or object, and the enclosing container while a list
+		// is walked without recursion
+		struct {
+			struct slog_node *items;
+			struct slog_node *parent;
+		} nested;
 	} value;
 
 	struct slog_node *next;
 };
 
-static const struct slog_node slog_node_default = {0};
+// Stack-allocated counterpart of slog_node used by SLOG_FIELDS: nested
+// fields are arrays with a count instead of linked lists.
+struct slog_field {
+	enum slog_type type;
+
+	const char *key;
+	union {
+		const char *string;
+		double number;
+		long long integer;
+		bool boolean;
+		struct {
+			const struct slog_field *items;
+			size_t count;
+		} list;
+		struct {
+			const char *data;
+			size_t len;
+		} text;
+	} value;
+};
 
 static SLOG_THREAD_LOCAL struct slog_node *slog_node_thread_local = NULL;
 
+// Per-thread memory limits. Pooled nodes beyond max_pooled_nodes are freed
+// when returned, and a buffer that grew past max_buffer_bytes for a large
+// record shrinks back after the next record that fits. SIZE_MAX disables
+// either limit.
+struct slog_memory_config {
+	size_t max_pooled_nodes; // default 1024
+	size_t max_buffer_bytes; // default 64 KiB, at least PIPE_BUF
+};
+
+struct slog_memory_stats {
+	unsigned long long pool_hits;     // nodes reused from a pool
+	unsigned long long pool_misses;   // nodes allocated
+	unsigned long long pool_released; // nodes freed because a pool was full
+	size_t pooled_nodes;              // currently pooled, all threads
+	size_t buffer_bytes;              // current buffer capacity, all threads
+	size_t buffer_high_water;         // largest buffer of any thread
+	size_t threads;                   // threads holding slog memory
+};
+
+// Handler times are sampled once every SLOG_STATS_SAMPLE records per
+// thread. Bucket i counts calls that took less than 128 << i ns; the last
+// one also counts everything slower.
+#define SLOG_STATS_SAMPLE 64
+#define SLOG_STATS_BUCKETS 16
+
+struct slog_stats {
+	unsigned long long records[SLOG_LAST];  // emitted, per level
+	unsigned long long filtered[SLOG_LAST]; // rejected by the level check
+	unsigned long long bytes;               // serialized
+	unsigned long long reallocs;            // output buffer growths
+	unsigned long long pool_misses;         // nodes allocated
+	unsigned long long handler_ns[SLOG_STATS_BUCKETS];
+};
+
+static size_t slog_memory_max_nodes = 1024;
+static size_t slog_memory_max_buffer = 64 * 1024;
+
+// Counters are only written by their thread, with relaxed stores, so that
+// SLOG_MEMORY_STATS and SLOG_STATS can read them while the thread keeps
+// logging.
+struct slog_thread_memory {
+	struct slog_memory_stats stats;
+	struct slog_stats counters;
+	unsigned handler_calls; // picks the handler calls that are timed
+	// complete binary records not written yet, for the crash handler
+	const char *binary_data;
+	size_t binary_len;
+	unsigned binary_epoch;
+	struct slog_thread_memory *prev;
+	struct slog_thread_memory *next;
+	bool registered;
+};
+
+static SLOG_THREAD_LOCAL struct slog_thread_memory slog_thread_memory;
+
+static pthread_mutex_t slog_memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slog_memory_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slog_memory_key;
+static struct slog_thread_memory *slog_memory_threads = NULL;
+static struct slog_memory_stats slog_memory_retired; // exited threads
+static struct slog_stats slog_stats_retired;
+
+#define SLOG_STAT_ADD(FIELD, N)                                                \
+	__atomic_store_n(&slog_thread_memory.stats.FIELD,                      \
+			 slog_thread_memory.stats.FIELD + (N),                 \
+			 __ATOMIC_RELAXED)
+
+#define SLOG_COUNT_ADD(FIELD, N)                                               \
+	__atomic_store_n(&slog_thread_memory.counters.FIELD,                   \
+			 slog_thread_memory.counters.FIELD + (N),              \
+			 __ATOMIC_RELAXED)
+
+void SLOG_FREE(void);
+
+// Releases what a thread still holds when it exits without SLOG_FREE.
+static void slog_memory_thread_exit(void *arg) {
+	(void)arg;
+	SLOG_FREE();
+}
+
+static void slog_memory_init(void) {
+	pthread_key_create(&slog_memory_key, slog_memory_thread_exit);
+}
+
+static void slog_memory_register(void) {
+	if (slog_thread_memory.registered) {
+		return;
+	}
+	pthread_once(&slog_memory_once, slog_memory_init);
+	pthread_setspecific(slog_memory_key, &slog_thread_memory);
+	pthread_mutex_lock(&slog_memory_lock);
+	slog_thread_memory.prev = NULL;
+	slog_thread_memory.next = slog_memory_threads;
+	if (slog_memory_threads) {
+		slog_memory_threads->prev = &slog_thread_memory;
+	}
+	slog_memory_threads = &slog_thread_memory;
+	slog_thread_memory.registered = true;
+	pthread_mutex_unlock(&slog_memory_lock);
+}
+
+static void slog_stats_add(struct slog_stats *total,
+			   const struct slog_stats *s) {
+	for (int i = 0; i < SLOG_LAST; i++) {
+		total->records[i] +=
+			__atomic_load_n(&s->records[i], __ATOMIC_RELAXED);
+		total->filtered[i] +=
+			__atomic_load_n(&s->filtered[i], __ATOMIC_RELAXED);
+	}
+	total->bytes += __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+	total->reallocs += __atomic_load_n(&s->reallocs, __ATOMIC_RELAXED);
+	for (int i = 0; i < SLOG_STATS_BUCKETS; i++) {
+		total->handler_ns[i] +=
+			__atomic_load_n(&s->handler_ns[i], __ATOMIC_RELAXED);
+	}
+}
+
+// Called once the thread has freed its pool and buffer.
+static void slog_memory_unregister(void) {
+	if (!slog_thread_memory.registered) {
+		return;
+	}
+	pthread_setspecific(slog_memory_key, NULL);
+	pthread_mutex_lock(&slog_memory_lock);
+	struct slog_thread_memory *t = &slog_thread_memory;
+	if (t->prev) {
+		t->prev->next = t->next;
+	} else {
+		slog_memory_threads = t->next;
+	}
+	if (t->next) {
+		t->next->prev = t->prev;
+	}
+	slog_memory_retired.pool_hits += t->stats.pool_hits;
+	slog_memory_retired.pool_misses += t->stats.pool_misses;
+	slog_memory_retired.pool_released += t->stats.pool_released;
+	slog_stats_add(&slog_stats_retired, &t->counters);
+	if (t->stats.buffer_high_water > slog_memory_retired.buffer_high_water) {
+		slog_memory_retired.buffer_high_water =
+			t->stats.buffer_high_water;
+	}
+	memset(t, 0, sizeof(*t));
+	pthread_mutex_unlock(&slog_memory_lock);
+}
+
+void SLOG_SET_MEMORY(const struct slog_memory_config *config) {
+	assert(config);
+	__atomic_store_n(&slog_memory_max_nodes, config->max_pooled_nodes,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&slog_memory_max_buffer,
+			 config->max_buffer_bytes > PIPE_BUF
+				 ? config->max_buffer_bytes
+				 : (size_t)PIPE_BUF,
+			 __ATOMIC_RELAXED);
+}
+
+// Totals over live threads and the threads that already released theirs.
+void SLOG_MEMORY_STATS(struct slog_memory_stats *stats) {
+	assert(stats);
+	pthread_mutex_lock(&slog_memory_lock);
+	*stats = slog_memory_retired;
+	for (struct slog_thread_memory *t = slog_memory_threads; t;
+	     t = t->next) {
+		const struct slog_memory_stats *s = &t->stats;
+		stats->pool_hits += __atomic_load_n(&s->pool_hits,
+						    __ATOMIC_RELAXED);
+		stats->pool_misses += __atomic_load_n(&s->pool_misses,
+						      __ATOMIC_RELAXED);
+		stats->pool_released += __atomic_load_n(&s->pool_released,
+							__ATOMIC_RELAXED);
+		stats->pooled_nodes += __atomic_load_n(&s->pooled_nodes,
+						       __ATOMIC_RELAXED);
+		stats->buffer_bytes += __atomic_load_n(&s->buffer_bytes,
+						       __ATOMIC_RELAXED);
+		const size_t high =
+			__atomic_load_n(&s->buffer_high_water, __ATOMIC_RELAXED);
+		if (high > stats->buffer_high_water) {
+			stats->buffer_high_water = high;
+		}
+		stats->threads++;
+	}
+	pthread_mutex_unlock(&slog_memory_lock);
+}
+
+// Totals over every thread since the start of the process.
+void SLOG_STATS(struct slog_stats *stats) {
+	assert(stats);
+	struct slog_memory_stats memory;
+	SLOG_MEMORY_STATS(&memory);
+	pthread_mutex_lock(&slog_memory_lock);
+	*stats = slog_stats_retired;
+	for (struct slog_thread_memory *t = slog_memory_threads; t;
+	     t = t->next) {
+		slog_stats_add(stats, &t->counters);
+	}
+	pthread_mutex_unlock(&slog_memory_lock);
+	stats->pool_misses = memory.pool_misses;
+}
+
+static void slog_stats_filtered(enum slog_level level) {
+	slog_memory_register();
+	SLOG_COUNT_ADD(filtered[level], 1);
+}
+
+static inline bool slog_stats_sample(void) {
+	return !(slog_thread_memory.handler_calls++ % SLOG_STATS_SAMPLE);
+}
+
+static inline uint64_t slog_stats_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void slog_stats_handler_time(uint64_t start) {
+	const uint64_t slots = (slog_stats_clock() - start) >> 7;
+	int bucket = slots ? 64 - __builtin_clzll(slots) : 0;
+	if (bucket >= SLOG_STATS_BUCKETS) {
+		bucket = SLOG_STATS_BUCKETS - 1;
+	}
+	slog_memory_register();
+	SLOG_COUNT_ADD(handler_ns[bucket], 1);
+}
+
 struct slog_node *slog_node_get() {
 	struct slog_node *node;
 
 	if (slog_node_thread_local) {
 		node = slog_node_thread_local;
 		slog_node_thread_local = node->next;
+		SLOG_STAT_ADD(pool_hits, 1);
+		SLOG_STAT_ADD(pooled_nodes, -1);
 	} else {
-		node = calloc(1, sizeof(*node));
+		slog_memory_register();
+		node = (struct slog_node *)calloc(1, sizeof(*node));
+		SLOG_STAT_ADD(pool_misses, 1);
 	}
-	*node = slog_node_default;
+	memset(node, 0, sizeof(*node));
 	return node;
 }
 
@@ -84,57 +414,634 @@ void slog_node_put(struct slog_node *node) {
 	if (!node) {
 		return;
 	}
+	if (slog_thread_memory.stats.pooled_nodes >=
+	    __atomic_load_n(&slog_memory_max_nodes, __ATOMIC_RELAXED)) {
+		free(node);
+		SLOG_STAT_ADD(pool_released, 1);
+		return;
+	}
 	node->next = slog_node_thread_local;
 	slog_node_thread_local = node;
+	SLOG_STAT_ADD(pooled_nodes, 1);
 }
 
 void slog_node_free(struct slog_node *node) {
-	if (!node) {
-		return;
+	while (node) {
+		struct slog_node *next = node->next;
+		free(node);
+		node = next;
 	}
-	slog_node_free(node->next);
-	free(node);
 }
 
 typedef void (*slog_output_handler_t)(const char *);
 
+// Record encodings. JSON and logfmt records are text lines; CBOR and
+// MessagePack records are binary maps with the same members, so handlers
+// of those need a writer, which is given the length.
+enum slog_encoding {
+	SLOG_ENCODING_JSON = 0,
+	SLOG_ENCODING_LOGFMT,
+	SLOG_ENCODING_CBOR,
+	SLOG_ENCODING_MSGPACK,
+};
+
+// A serialized record as handed to a writer. data is NUL-terminated for
+// text encodings, but len is the record's length in every encoding.
+struct slog_record {
+	char *data;
+	size_t len;
+	size_t size; // bytes allocated at data
+	enum slog_level level;
+	struct timespec time;
+	enum slog_encoding encoding; // binary ones are not lines
+};
+
+// Writers see the record only for the duration of the call, unless they
+// were set as owners: then data is theirs until SLOG_RECORD_RELEASE.
+typedef void (*slog_writer_t)(const struct slog_record *record);
+
 struct slog_buffer {
 	char *data;
 	size_t size;
 	size_t index;
 };
 
-static SLOG_THREAD_LOCAL struct slog_buffer slog_buffer = {0};
+static SLOG_THREAD_LOCAL struct slog_buffer slog_buffer = {NULL, 0, 0};
+
+// Start of the record body (msg and fields) in slog_buffer, set once the
+// time is written.
+static SLOG_THREAD_LOCAL size_t slog_record_body = 0;
+
+// Process-wide configuration. Every change bumps the generation, so each
+// callsite resolves its level again on its next call and caches the result.
+static slog_output_handler_t slog_output_handler = NULL;
+static slog_writer_t slog_writer = NULL;
+static bool slog_writer_owns = false;
+static enum slog_level slog_current_level = SLOG_DEBUG;
+static unsigned slog_config_generation = 1;
+
+struct slog_level_override {
+	char *module; // "*" matches callsites no other entry matches
+	enum slog_level level;
+};
+
+static pthread_mutex_t slog_overrides_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slog_overrides_once = PTHREAD_ONCE_INIT;
+static struct slog_level_override *slog_overrides = NULL;
+static size_t slog_overrides_count = 0;
 
-static SLOG_THREAD_LOCAL slog_output_handler_t slog_output_handler;
-static SLOG_THREAD_LOCAL enum slog_level slog_current_level = SLOG_DEBUG;
+static void slog_config_changed(void) {
+	// generation 0 is reserved for unresolved callsites
+	unsigned *generation = &slog_config_generation;
+	if (!(__atomic_add_fetch(generation, 1, __ATOMIC_RELEASE) &
+	      0x7fffffffu)) {
+		__atomic_add_fetch(generation, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void slog_handler_writer(const struct slog_record *record) {
+	slog_output_handler_t handler =
+		__atomic_load_n(&slog_output_handler, __ATOMIC_ACQUIRE);
+	if (handler) {
+		handler(record->data);
+	}
+}
 
 void SLOG_SET_HANDLER(slog_output_handler_t cb) {
 	assert(cb);
-	slog_output_handler = cb;
+	__atomic_store_n(&slog_output_handler, cb, __ATOMIC_RELEASE);
+	__atomic_store_n(&slog_writer_owns, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&slog_writer, &slog_handler_writer, __ATOMIC_RELEASE);
+}
+
+// Sends records to writer with their length, level and timestamp. An
+// owning writer keeps each buffer and the logging thread continues with a
+// recycled one; choose the mode before logging starts.
+void SLOG_SET_WRITER(slog_writer_t writer, bool owns) {
+	assert(writer);
+	__atomic_store_n(&slog_writer_owns, owns, __ATOMIC_RELAXED);
+	__atomic_store_n(&slog_writer, writer, __ATOMIC_RELEASE);
+}
+
+// Buffers given back by owning writers, reused by the logging threads.
+#define SLOG_RECORD_POOL 64
+
+static pthread_mutex_t slog_record_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	char *data;
+	size_t size;
+} slog_record_pool[SLOG_RECORD_POOL];
+static size_t slog_record_pool_count = 0;
+
+void SLOG_RECORD_RELEASE(const struct slog_record *record) {
+	assert(record);
+	if (record->size <=
+	    __atomic_load_n(&slog_memory_max_buffer, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&slog_record_pool_lock);
+		if (slog_record_pool_count < SLOG_RECORD_POOL) {
+			slog_record_pool[slog_record_pool_count].data =
+				record->data;
+			slog_record_pool[slog_record_pool_count].size =
+				record->size;
+			__atomic_store_n(&slog_record_pool_count,
+					 slog_record_pool_count + 1,
+					 __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&slog_record_pool_lock);
+			return;
+		}
+		pthread_mutex_unlock(&slog_record_pool_lock);
+	}
+	free(record->data);
+}
+
+// Takes a released buffer, or returns false when there is none.
+static bool slog_record_pool_get(char **data, size_t *size) {
+	if (!__atomic_load_n(&slog_record_pool_count, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	pthread_mutex_lock(&slog_record_pool_lock);
+	const bool found = slog_record_pool_count > 0;
+	if (found) {
+		const size_t i = slog_record_pool_count - 1;
+		*data = slog_record_pool[i].data;
+		*size = slog_record_pool[i].size;
+		__atomic_store_n(&slog_record_pool_count, i, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&slog_record_pool_lock);
+	return found;
+}
+
+static int slog_encoding = SLOG_ENCODING_JSON;
+
+void SLOG_SET_ENCODING(enum slog_encoding encoding) {
+	__atomic_store_n(&slog_encoding, encoding, __ATOMIC_RELAXED);
+}
+
+static inline bool slog_encoding_binary(int encoding) {
+	return encoding == SLOG_ENCODING_CBOR ||
+	       encoding == SLOG_ENCODING_MSGPACK;
+}
+
+#define SLOG_ENCODINGS (SLOG_ENCODING_MSGPACK + 1)
+
+// Sinks fan records out to several outputs, each with its own level and
+// encoding: errors to a file, debug to a ring. A record is serialized once
+// per encoding its sinks use and that buffer is shared by all of them.
+// While any sink is registered, sinks replace the handler or writer and
+// callsites are enabled up to the most verbose sink.
+typedef void (*slog_sink_t)(const struct slog_record *record, void *arg);
+
+struct slog_sink_config {
+	slog_sink_t write;
+	void *arg;
+	enum slog_level level; // takes records up to this level
+	enum slog_encoding encoding;
+};
+
+#define SLOG_SINKS 16
+
+// Published whole and never changed, so a writer sees write and arg of the
+// same sink. Removed sinks are kept, since records in flight may still
+// hold them.
+struct slog_sink {
+	struct slog_sink_config config;
+	struct slog_sink *next; // on slog_sinks_retired
+};
+
+static pthread_mutex_t slog_sinks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slog_sink *slog_sinks[SLOG_SINKS];
+static struct slog_sink *slog_sinks_retired;
+
+// Sinks taking each level, one bit per sink, by encoding; rebuilt under
+// the lock and read without it.
+static unsigned slog_sink_masks[SLOG_LAST][SLOG_ENCODINGS];
+static int slog_sink_level = -1; // the most verbose sink, -1 without any
+
+// Caller holds slog_sinks_lock.
+static void slog_sinks_changed(void) {
+	int verbose = -1;
+	for (int level = 0; level < SLOG_LAST; level++) {
+		unsigned masks[SLOG_ENCODINGS] = {0};
+		for (int i = 0; i < SLOG_SINKS; i++) {
+			const struct slog_sink *s = slog_sinks[i];
+			if (s && level <= (int)s->config.level) {
+				masks[s->config.encoding] |= 1u << i;
+				verbose = level;
+			}
+		}
+		for (int e = 0; e < SLOG_ENCODINGS; e++) {
+			__atomic_store_n(&slog_sink_masks[level][e], masks[e],
+					 __ATOMIC_RELAXED);
+		}
+	}
+	__atomic_store_n(&slog_sink_level, verbose, __ATOMIC_RELEASE);
+	slog_config_changed();
+}
+
+// Returns the sink's id, or -1 when all SLOG_SINKS are taken.
+int SLOG_SINK_ADD(const struct slog_sink_config *config) {
+	assert(config && config->write);
+	assert((unsigned)config->encoding < SLOG_ENCODINGS);
+	struct slog_sink *sink = (struct slog_sink *)malloc(sizeof(*sink));
+	if (!sink) {
+		fprintf(stderr, "Sink allocation failed\n");
+		return -1;
+	}
+	sink->config = *config;
+	sink->next = NULL;
+	pthread_mutex_lock(&slog_sinks_lock);
+	int id = -1;
+	for (int i = 0; i < SLOG_SINKS && id < 0; i++) {
+		if (!slog_sinks[i]) {
+			__atomic_store_n(&slog_sinks[i], sink, __ATOMIC_RELEASE);
+			id = i;
+		}
+	}
+	if (id >= 0) {
+		slog_sinks_changed();
+	}
+	pthread_mutex_unlock(&slog_sinks_lock);
+	if (id < 0) {
+		free(sink);
+	}
+	return id;
+}
+
+// Caller holds slog_sinks_lock.
+static void slog_sink_retire(int id) {
+	struct slog_sink *sink = slog_sinks[id];
+	if (sink) {
+		__atomic_store_n(&slog_sinks[id], NULL, __ATOMIC_RELEASE);
+		sink->next = slog_sinks_retired;
+		slog_sinks_retired = sink;
+	}
+}
+
+// Records already being written may still reach the sink, so its arg
+// must outlive the threads logging at the time.
+void SLOG_SINK_REMOVE(int id) {
+	assert(id >= 0 && id < SLOG_SINKS);
+	pthread_mutex_lock(&slog_sinks_lock);
+	slog_sink_retire(id);
+	slog_sinks_changed();
+	pthread_mutex_unlock(&slog_sinks_lock);
+}
+
+// sinks is the mask a pass of the given encoding was made for. A slot
+// reused since then holds another sink, which only gets the record when
+// it would have taken it anyway.
+static void slog_sinks_write(const struct slog_record *record,
+			     unsigned sinks, int encoding) {
+	while (sinks) {
+		const int i = __builtin_ctz(sinks);
+		sinks &= sinks - 1;
+		const struct slog_sink *s =
+			__atomic_load_n(&slog_sinks[i], __ATOMIC_ACQUIRE);
+		if (s && (int)s->config.encoding == encoding &&
+		    record->level <= s->config.level) {
+			s->config.write(record, s->config.arg);
+		}
+	}
+}
+
+// Writes records to the FILE * given as arg, text ones one per line.
+void slog_stream_sink(const struct slog_record *record, void *arg) {
+	FILE *stream = (FILE *)arg;
+	fwrite(record->data, 1, record->len, stream);
+	if (!slog_encoding_binary(record->encoding)) {
+		fputc('\n', stream);
+	}
+	fflush(stream);
+}
+
+// One serialization of a record: every encoding its sinks use in turn,
+// JSON last since writing nodes as JSON consumes them, or the process-wide
+// encoding once when there are no sinks.
+struct slog_pass {
+	enum slog_level level;
+	unsigned todo;  // encodings left, one bit each
+	int encoding;   // of the current pass
+	unsigned sinks; // taking the current pass, 0 for the single output
+	int count;      // passes started
+};
+
+#define SLOG_PASS_SINGLE (1u << SLOG_ENCODINGS)
+
+static inline void slog_pass_begin(struct slog_pass *pass,
+				   enum slog_level level) {
+	pass->level = level;
+	pass->count = 0;
+	pass->todo = SLOG_PASS_SINGLE;
+	if (__atomic_load_n(&slog_sink_level, __ATOMIC_ACQUIRE) < 0) {
+		return;
+	}
+	pass->todo = 0;
+	for (int e = 0; e < SLOG_ENCODINGS; e++) {
+		if (__atomic_load_n(&slog_sink_masks[level][e],
+				    __ATOMIC_RELAXED)) {
+			pass->todo |= 1u << e;
+		}
+	}
+}
+
+static inline bool slog_pass_next(struct slog_pass *pass) {
+	if (pass->todo == SLOG_PASS_SINGLE) {
+		pass->todo = 0;
+		pass->count++;
+		pass->encoding =
+			__atomic_load_n(&slog_encoding, __ATOMIC_RELAXED);
+		pass->sinks = 0;
+		return true;
+	}
+	while (pass->todo) {
+		pass->encoding = 31 - __builtin_clz(pass->todo);
+		pass->todo &= ~(1u << pass->encoding);
+		// sinks removed since slog_pass_begin leave empty passes
+		pass->sinks = __atomic_load_n(
+			&slog_sink_masks[pass->level][pass->encoding],
+			__ATOMIC_RELAXED);
+		if (pass->sinks) {
+			pass->count++;
+			return true;
+		}
+	}
+	return false;
 }
 
 void SLOG_SET_LEVEL(enum slog_level level) {
-	slog_current_level = level;
+	__atomic_store_n(&slog_current_level, level, __ATOMIC_RELAXED);
+	slog_config_changed();
 }
 
 enum slog_level SLOG_GET_LEVEL(void) {
-	return slog_current_level;
+	return __atomic_load_n(&slog_current_level, __ATOMIC_RELAXED);
+}
+
+static bool slog_parse_level(const char *str, size_t len,
+			     enum slog_level *level) {
+	for (int i = 0; i < SLOG_LAST; i++) {
+		const char *name = slog_level_names[i];
+		size_t j = 0;
+		while (j < len && name[j] &&
+		       (str[j] == name[j] || str[j] == name[j] + 'a' - 'A')) {
+			j++;
+		}
+		if (j == len && !name[j]) {
+			*level = (enum slog_level)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Caller holds slog_overrides_lock.
+static bool slog_override_set(const char *module, size_t len,
+			      enum slog_level level) {
+	for (size_t i = 0; i < slog_overrides_count; i++) {
+		if (strlen(slog_overrides[i].module) == len &&
+		    !memcmp(slog_overrides[i].module, module, len)) {
+			slog_overrides[i].level = level;
+			return true;
+		}
+	}
+	struct slog_level_override *grown =
+		(struct slog_level_override *)realloc(
+			slog_overrides,
+			(slog_overrides_count + 1) * sizeof(*grown));
+	if (!grown) {
+		return false;
+	}
+	slog_overrides = grown;
+	char *copy = (char *)malloc(len + 1);
+	if (!copy) {
+		return false;
+	}
+	memcpy(copy, module, len);
+	copy[len] = '\0';
+	slog_overrides[slog_overrides_count].module = copy;
+	slog_overrides[slog_overrides_count].level = level;
+	slog_overrides_count++;
+	return true;
+}
+
+// Applies "module=level,..." entries; nothing is applied when one is invalid.
+static bool slog_levels_apply(const char *spec) {
+	bool ok = true;
+	pthread_mutex_lock(&slog_overrides_lock);
+	for (int apply = 0; apply < 2 && ok; apply++) {
+		for (const char *p = spec; *p && ok;) {
+			const size_t len = strcspn(p, ",");
+			const char *eq = (const char *)memchr(p, '=', len);
+			const size_t key = eq ? (size_t)(eq - p) : 0;
+			enum slog_level level;
+			ok = key && slog_parse_level(eq + 1, len - key - 1,
+						     &level);
+			if (ok && apply) {
+				ok = slog_override_set(p, key, level);
+			}
+			p += len + (p[len] == ',');
+		}
+	}
+	pthread_mutex_unlock(&slog_overrides_lock);
+	slog_config_changed();
+	return ok;
+}
+
+static void slog_levels_from_env(void) {
+	const char *spec = getenv("SLOG_LEVELS");
+	if (spec && !slog_levels_apply(spec)) {
+		fprintf(stderr, "Invalid SLOG_LEVELS: %s\n", spec);
+	}
 }
 
+// Sets levels from a spec like "net=debug,db=info,*=warn", the format of
+// the SLOG_LEVELS environment variable, which is read first.
+bool SLOG_SET_LEVELS(const char *spec) {
+	assert(spec);
+	pthread_once(&slog_overrides_once, slog_levels_from_env);
+	return slog_levels_apply(spec);
+}
+
+bool SLOG_SET_MODULE_LEVEL(const char *module, enum slog_level level) {
+	assert(module);
+	pthread_once(&slog_overrides_once, slog_levels_from_env);
+	pthread_mutex_lock(&slog_overrides_lock);
+	const bool ok = slog_override_set(module, strlen(module), level);
+	pthread_mutex_unlock(&slog_overrides_lock);
+	slog_config_changed();
+	return ok;
+}
+
+// Restores the process-wide defaults: stdout, SLOG_DEBUG, no overrides,
+// no sinks.
+void SLOG_RESET(void) {
+	pthread_once(&slog_overrides_once, slog_levels_from_env);
+	pthread_mutex_lock(&slog_overrides_lock);
+	for (size_t i = 0; i < slog_overrides_count; i++) {
+		free(slog_overrides[i].module);
+	}
+	free(slog_overrides);
+	slog_overrides = NULL;
+	slog_overrides_count = 0;
+	pthread_mutex_unlock(&slog_overrides_lock);
+	__atomic_store_n(&slog_output_handler, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&slog_writer, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&slog_writer_owns, false, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&slog_sinks_lock);
+	for (int i = 0; i < SLOG_SINKS; i++) {
+		slog_sink_retire(i);
+	}
+	slog_sinks_changed();
+	pthread_mutex_unlock(&slog_sinks_lock);
+	SLOG_SET_LEVEL(SLOG_DEBUG);
+}
+
+// A module matches SLOG_MODULE or any component of the file path, the
+// last one without its extension: "net" matches src/net/tcp.c and net.c.
+static bool slog_module_matches(const struct slog_callsite *site,
+				const char *module) {
+	if (site->module && !strcmp(site->module, module)) {
+		return true;
+	}
+	const size_t n = strlen(module);
+	for (const char *p = site->file; *p;) {
+		const char *end = p + strcspn(p, "/");
+		size_t len = (size_t)(end - p);
+		if (!*end) {
+			const char *dot = (const char *)memchr(p, '.', len);
+			len = dot ? (size_t)(dot - p) : len;
+		}
+		if (len == n && !memcmp(p, module, n)) {
+			return true;
+		}
+		p = *end ? end + 1 : end;
+	}
+	return false;
+}
+
+static bool slog_callsite_resolve(struct slog_callsite *site) {
+	pthread_once(&slog_overrides_once, slog_levels_from_env);
+	const unsigned generation =
+		__atomic_load_n(&slog_config_generation, __ATOMIC_ACQUIRE);
+	enum slog_level level = SLOG_GET_LEVEL();
+
+	pthread_mutex_lock(&slog_overrides_lock);
+	const struct slog_level_override *match = NULL;
+	const struct slog_level_override *fallback = NULL;
+	for (size_t i = 0; i < slog_overrides_count && !match; i++) {
+		const struct slog_level_override *o = &slog_overrides[i];
+		if (!strcmp(o->module, "*")) {
+			fallback = o;
+		} else if (slog_module_matches(site, o->module)) {
+			match = o;
+		}
+	}
+	if (match || fallback) {
+		level = match ? match->level : fallback->level;
+	}
+	pthread_mutex_unlock(&slog_overrides_lock);
+
+	const int sinks = __atomic_load_n(&slog_sink_level, __ATOMIC_ACQUIRE);
+	if (sinks >= 0 && (int)level > sinks) {
+		level = (enum slog_level)sinks;
+	}
+
+	const bool enabled = site->level <= level;
+	__atomic_store_n(&site->enabled,
+			 (generation & 0x7fffffffu) << 1 | enabled,
+			 __ATOMIC_RELAXED);
+	if (!enabled) {
+		slog_stats_filtered(site->level);
+	}
+	return enabled;
+}
+
+// The per-call check: one relaxed load of the generation plus the cached
+// state of the callsite.
+static inline bool slog_callsite_enabled(struct slog_callsite *site) {
+	const unsigned generation =
+		__atomic_load_n(&slog_config_generation, __ATOMIC_RELAXED);
+	const unsigned state =
+		__atomic_load_n(&site->enabled, __ATOMIC_RELAXED);
+	if (state >> 1 == (generation & 0x7fffffffu)) {
+		if (state & 1) {
+			return true;
+		}
+		slog_stats_filtered(site->level);
+		return false;
+	}
+	return slog_callsite_resolve(site);
+}
+
+// The most verbose level any callsite resolves to under the configuration
+// of the generation it was computed in: generation << 3 | (level + 1).
+static unsigned slog_level_ceiling = 0;
+
+static unsigned slog_level_ceiling_resolve(void) {
+	pthread_once(&slog_overrides_once, slog_levels_from_env);
+	const unsigned generation =
+		__atomic_load_n(&slog_config_generation, __ATOMIC_ACQUIRE);
+	int level = SLOG_GET_LEVEL();
+	pthread_mutex_lock(&slog_overrides_lock);
+	for (size_t i = 0; i < slog_overrides_count; i++) {
+		if ((int)slog_overrides[i].level > level) {
+			level = slog_overrides[i].level;
+		}
+	}
+	pthread_mutex_unlock(&slog_overrides_lock);
+	const int sinks = __atomic_load_n(&slog_sink_level, __ATOMIC_ACQUIRE);
+	if (sinks >= 0 && level > sinks) {
+		level = sinks;
+	}
+	const unsigned state =
+		(generation & 0x1fffffffu) << 3 | (unsigned)(level + 1);
+	__atomic_store_n(&slog_level_ceiling, state, __ATOMIC_RELAXED);
+	return state;
+}
+
+// Whether any callsite of this level can be enabled, for front ends that
+// look their callsite up: records no override lets through are rejected
+// at the cost of slog_callsite_enabled, before the lookup.
+static inline bool slog_level_possible(enum slog_level level) {
+	const unsigned generation =
+		__atomic_load_n(&slog_config_generation, __ATOMIC_RELAXED);
+	unsigned state = __atomic_load_n(&slog_level_ceiling, __ATOMIC_RELAXED);
+	if (state >> 3 != (generation & 0x1fffffffu) || !(state & 7)) {
+		state = slog_level_ceiling_resolve();
+	}
+	if ((unsigned)level + 1 <= (state & 7)) {
+		return true;
+	}
+	slog_stats_filtered(level);
+	return false;
+}
+
+void SLOG_ASYNC_STOP(void);
+static bool slog_async_owner(void);
+static int slog_binary_target(void);
+static void slog_binary_flush(void);
+static void slog_binary_reset_thread(void);
+static void slog_key_cache_free(void);
+static void slog_dedup_sweep(long long now);
+
+// Releases the calling thread's buffers and caches; process-wide settings
+// stay until SLOG_RESET.
 void SLOG_FREE(void) {
+	if (slog_async_owner()) {
+		SLOG_ASYNC_STOP();
+	}
+	if (slog_binary_target() >= 0) {
+		slog_binary_flush();
+	}
+	slog_binary_reset_thread();
+	slog_key_cache_free();
 	slog_node_free(slog_node_thread_local);
 	slog_node_thread_local = NULL;
-	slog_output_handler = NULL;
-	slog_current_level = SLOG_DEBUG;
 	free(slog_buffer.data);
 	slog_buffer.data = NULL;
 	slog_buffer.size = 0;
 	slog_buffer.index = 0;
-}
-
-static inline bool slog_level_should_log(enum slog_level level) {
-	return level <= slog_current_level;
+	slog_memory_unregister();
 }
 
 static bool slog_buffer_reserve(size_t additional) {
@@ -143,6 +1050,13 @@ static bool slog_buffer_reserve(size_t additional) {
 		return false;
 	}
 
+	// a buffer given back by an owning writer saves the allocation
+	if (!slog_buffer.data &&
+	    slog_record_pool_get(&slog_buffer.data, &slog_buffer.size)) {
+		slog_memory_register();
+		SLOG_STAT_ADD(buffer_bytes, slog_buffer.size);
+	}
+
 	const size_t needed = slog_buffer.index + additional + 1;
 	if (needed <= slog_buffer.size) {
 		return true;
@@ -157,17 +1071,40 @@ static bool slog_buffer_reserve(size_t additional) {
 		}
 	}
 
-	char *new_data = realloc(slog_buffer.data, new_size);
+	char *new_data = (char *)realloc(slog_buffer.data, new_size);
 	if (!new_data) {
 		fprintf(stderr, "Buffer allocation failed\n");
 		return false;
 	}
 
+	slog_memory_register();
+	SLOG_COUNT_ADD(reallocs, 1);
+	SLOG_STAT_ADD(buffer_bytes, new_size - slog_buffer.size);
+	if (new_size > slog_thread_memory.stats.buffer_high_water) {
+		SLOG_STAT_ADD(buffer_high_water,
+			      new_size - slog_thread_memory.stats.buffer_high_water);
+	}
 	slog_buffer.data = new_data;
 	slog_buffer.size = new_size;
 	return true;
 }
 
+// Gives back the memory of a spike once a record of `used` bytes fits the
+// limit again.
+static void slog_buffer_trim(size_t used) {
+	const size_t limit =
+		__atomic_load_n(&slog_memory_max_buffer, __ATOMIC_RELAXED);
+	if (slog_buffer.size <= limit || used >= limit) {
+		return;
+	}
+	char *smaller = (char *)realloc(slog_buffer.data, limit);
+	if (smaller) {
+		SLOG_STAT_ADD(buffer_bytes, limit - slog_buffer.size);
+		slog_buffer.data = smaller;
+		slog_buffer.size = limit;
+	}
+}
+
 static const char *slog_buffer_flush_and_reset(void) {
 	if (!slog_buffer.data && !slog_buffer_reserve(0)) {
 		return NULL;
@@ -178,28 +1115,179 @@ static const char *slog_buffer_flush_and_reset(void) {
 	return buffer;
 }
 
-static void slog_buffer_append_formatted(const char *fmt, ...) {
-	va_list args;
-	va_start(args, fmt);
-	int len = vsnprintf(NULL, 0, fmt, args);
-	va_end(args);
-	if (len < 0) {
-		return;
-	}
+enum slog_clock {
+	SLOG_CLOCK_REALTIME = 0,
+	SLOG_CLOCK_COARSE,   // CLOCK_REALTIME_COARSE, tick resolution
+	SLOG_CLOCK_TSC,      // calibrated cycle counter, x86 only
+	SLOG_CLOCK_CALLBACK, // user function
+};
 
-	if (!slog_buffer_reserve((size_t)len)) {
-		return;
-	}
+typedef void (*slog_clock_fn)(struct timespec *ts);
+
+static int slog_clock_source = SLOG_CLOCK_REALTIME;
+static slog_clock_fn slog_clock_callback = NULL;
+static double slog_tsc_ns_per_tick = 0;
 
-	va_start(args, fmt);
-	vsnprintf(slog_buffer.data + slog_buffer.index,
-		  slog_buffer.size - slog_buffer.index, fmt, args);
-	va_end(args);
+// Each thread anchors the TSC to the real clock and re-anchors every
+// second, so wall clock steps and drift are picked up quickly.
+static SLOG_THREAD_LOCAL struct {
+	uint64_t tsc;
+	uint64_t limit; // ticks before the next anchor
+	struct timespec ts;
+} slog_tsc_anchor;
 
-	slog_buffer.index += (size_t)len;
+#if defined(__x86_64__) || defined(__i386__)
+#define SLOG_HAVE_TSC 1
+static inline uint64_t slog_tsc_read(void) {
+	return __builtin_ia32_rdtsc();
 }
+#else
+#define SLOG_HAVE_TSC 0
+static inline uint64_t slog_tsc_read(void) {
+	return 0;
+}
+#endif
 
-struct slog_node *slog_node_make_list(bool clear_keys, va_list ap) {
+static void slog_tsc_now(struct timespec *ts) {
+	double ns_per_tick;
+	__atomic_load(&slog_tsc_ns_per_tick, &ns_per_tick, __ATOMIC_RELAXED);
+	const uint64_t tsc = slog_tsc_read();
+	const uint64_t ticks = tsc - slog_tsc_anchor.tsc;
+	if (!slog_tsc_anchor.limit || ticks >= slog_tsc_anchor.limit) {
+		clock_gettime(CLOCK_REALTIME, &slog_tsc_anchor.ts);
+		slog_tsc_anchor.tsc = tsc;
+		slog_tsc_anchor.limit = (uint64_t)(1e9 / ns_per_tick);
+		*ts = slog_tsc_anchor.ts;
+		return;
+	}
+	const long long ns = slog_tsc_anchor.ts.tv_nsec +
+			     (long long)((double)ticks * ns_per_tick);
+	ts->tv_sec = slog_tsc_anchor.ts.tv_sec + (time_t)(ns / 1000000000);
+	ts->tv_nsec = (long)(ns % 1000000000);
+}
+
+// Measures the TSC rate against CLOCK_MONOTONIC_RAW over about 10ms.
+static double slog_tsc_calibrate(void) {
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	const uint64_t tsc = slog_tsc_read();
+	long long ns;
+	do {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		ns = (long long)(now.tv_sec - start.tv_sec) * 1000000000 +
+		     (now.tv_nsec - start.tv_nsec);
+	} while (ns < 10000000);
+	const uint64_t ticks = slog_tsc_read() - tsc;
+	return ticks ? (double)ns / (double)ticks : 0;
+}
+
+// Selects where record timestamps come from. fn is only used with
+// SLOG_CLOCK_CALLBACK; SLOG_CLOCK_TSC falls back to SLOG_CLOCK_REALTIME
+// when there is no usable cycle counter.
+void SLOG_SET_CLOCK(enum slog_clock source, slog_clock_fn fn) {
+	assert(source != SLOG_CLOCK_CALLBACK || fn);
+	if (source == SLOG_CLOCK_TSC) {
+		double rate = SLOG_HAVE_TSC ? slog_tsc_calibrate() : 0;
+		if (rate <= 0) {
+			source = SLOG_CLOCK_REALTIME;
+		}
+		__atomic_store(&slog_tsc_ns_per_tick, &rate, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&slog_clock_callback, fn, __ATOMIC_RELAXED);
+	__atomic_store_n(&slog_clock_source, (int)source, __ATOMIC_RELEASE);
+}
+
+static inline void slog_clock_now(struct timespec *ts) {
+	switch (__atomic_load_n(&slog_clock_source, __ATOMIC_ACQUIRE)) {
+	case SLOG_CLOCK_COARSE:
+#ifdef CLOCK_REALTIME_COARSE
+		clock_gettime(CLOCK_REALTIME_COARSE, ts);
+		break;
+#endif
+	case SLOG_CLOCK_REALTIME:
+		clock_gettime(CLOCK_REALTIME, ts);
+		break;
+	case SLOG_CLOCK_TSC:
+		slog_tsc_now(ts);
+		break;
+	case SLOG_CLOCK_CALLBACK:
+		__atomic_load_n(&slog_clock_callback, __ATOMIC_RELAXED)(ts);
+		break;
+	}
+}
+
+struct slog_dict_entry {
+	const void *ptr; // NULL marks an empty slot
+	const void *aux;
+	size_t n;
+	char *copy; // strings: what ptr pointed to when it was added
+	size_t fragment_len; // key cache: escaped key stored after copy
+	uint32_t id;
+};
+
+// Open-addressed pointer map, thread-local so lookups need no locking.
+struct slog_dict {
+	struct slog_dict_entry *entries;
+	size_t mask;
+	size_t count;
+};
+
+static inline size_t slog_dict_hash(const void *ptr, const void *aux,
+				    size_t n) {
+	uint64_t h = (uint64_t)(uintptr_t)ptr ^ ((uint64_t)(uintptr_t)aux << 7) ^
+		     ((uint64_t)n * 0x9e3779b97f4a7c15ULL);
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	return (size_t)(h ^ (h >> 32));
+}
+
+// Returns the entry for (ptr, aux, n), or the empty slot it belongs in.
+static struct slog_dict_entry *slog_dict_slot(struct slog_dict *dict,
+					       const void *ptr, const void *aux,
+					       size_t n) {
+	if (dict->count * 2 >= dict->mask) {
+		const size_t size = dict->entries ? (dict->mask + 1) * 2 : 64;
+		struct slog_dict_entry *entries = (struct slog_dict_entry *)calloc(
+			size, sizeof(*entries));
+		if (!entries) {
+			return NULL;
+		}
+		for (size_t i = 0; dict->entries && i <= dict->mask; i++) {
+			struct slog_dict_entry *e = &dict->entries[i];
+			if (!e->ptr) {
+				continue;
+			}
+			size_t j = slog_dict_hash(e->ptr, e->aux, e->n);
+			while (entries[j & (size - 1)].ptr) {
+				j++;
+			}
+			entries[j & (size - 1)] = *e;
+		}
+		free(dict->entries);
+		dict->entries = entries;
+		dict->mask = size - 1;
+	}
+
+	size_t i = slog_dict_hash(ptr, aux, n);
+	for (;; i++) {
+		struct slog_dict_entry *e = &dict->entries[i & dict->mask];
+		if (!e->ptr || (e->ptr == ptr && e->aux == aux && e->n == n)) {
+			return e;
+		}
+	}
+}
+
+static void slog_dict_free(struct slog_dict *dict) {
+	for (size_t i = 0; dict->entries && i <= dict->mask; i++) {
+		free(dict->entries[i].copy);
+	}
+	free(dict->entries);
+	dict->entries = NULL;
+	dict->mask = 0;
+	dict->count = 0;
+}
+
+struct slog_node *slog_node_make_list(bool clear_keys, va_list ap) {
 	struct slog_node *head = NULL;
 	struct slog_node **next_ptr = &head;
 	struct slog_node *current;
@@ -223,8 +1311,14 @@ struct slog_node *slog_node_vcreate(enum slog_type type, const char *key,
 
 	switch (type) {
 	case SLOG_TYPE_STRING:
+	case SLOG_TYPE_TRUSTED:
 		node->value.string = va_arg(ap, const char *);
 		break;
+	case SLOG_TYPE_STRING_N:
+	case SLOG_TYPE_RAW:
+		node->value.text.data = va_arg(ap, const char *);
+		node->value.text.len = va_arg(ap, size_t);
+		break;
 	case SLOG_TYPE_INT:
 		node->value.integer = va_arg(ap, long long);
 		break;
@@ -235,7 +1329,7 @@ struct slog_node *slog_node_vcreate(enum slog_type type, const char *key,
 		node->value.boolean = va_arg(ap, int);
 		break;
 	case SLOG_TYPE_TIME:
-		clock_gettime(CLOCK_REALTIME, &node->value.time);
+		slog_clock_now(&node->value.time);
 		break;
 	case SLOG_TYPE_ARRAY:
 		node->value.array = slog_node_make_list(true, ap);
@@ -255,162 +1349,3356 @@ struct slog_node *slog_node_create(enum slog_type type, const char *key, ...) {
 	return node;
 }
 
-void slog_write_escape(const char *str) {
-	assert(str);
+// Second character of the escape sequence for every byte that JSON requires
+// to be escaped, 'u' for the ones spelled as \u00XX, 0 for clean bytes.
+static const char slog_escape_table[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, '\\', 0, 0, 0,
+	// 0x60-0xff are all zero
+};
+
+static inline void slog_buffer_append(const char *data, size_t len) {
+	if (!slog_buffer_reserve(len)) {
+		return;
+	}
+	memcpy(slog_buffer.data + slog_buffer.index, data, len);
+	slog_buffer.index += len;
+}
 
-	slog_buffer_append_formatted("\"");
+static inline void slog_buffer_putc(char c) {
+	if (!slog_buffer_reserve(1)) {
+		return;
+	}
+	slog_buffer.data[slog_buffer.index++] = c;
+}
 
-	for (const char *p = str; *p; p++) {
-		unsigned char c = *p;
+// Returns the first byte in [p, end) that needs escaping, or end.
+static inline const char *slog_escape_scan(const char *p, const char *end) {
+#if defined(__AVX2__)
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i control = _mm256_set1_epi8(0x1f);
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+					    _mm256_cmpeq_epi8(v, backslash));
+		// unsigned v <= 0x1f  <=>  min(v, 0x1f) == v
+		m = _mm256_or_si256(
+			m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+	const __m128i quote16 = _mm_set1_epi8('"');
+	const __m128i backslash16 = _mm_set1_epi8('\\');
+	const __m128i control16 = _mm_set1_epi8(0x1f);
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote16),
+					 _mm_cmpeq_epi8(v, backslash16));
+		m = _mm_or_si128(m,
+				 _mm_cmpeq_epi8(_mm_min_epu8(v, control16), v));
+		unsigned mask = (unsigned)_mm_movemask_epi8(m);
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#endif
+	while (p < end && !slog_escape_table[(unsigned char)*p]) {
+		p++;
+	}
+	return p;
+}
 
-		switch (c) {
-		case '"':
-			slog_buffer_append_formatted("\\\"");
-			break;
-		case '\\':
-			slog_buffer_append_formatted("\\\\");
-			break;
-		case '\b':
-			slog_buffer_append_formatted("\\b");
-			break;
-		case '\f':
-			slog_buffer_append_formatted("\\f");
-			break;
-		case '\n':
-			slog_buffer_append_formatted("\\n");
-			break;
-		case '\r':
-			slog_buffer_append_formatted("\\r");
-			break;
-		case '\t':
-			slog_buffer_append_formatted("\\t");
+// Writes the escape sequence of c, which slog_escape_table flags, and
+// returns its length.
+static inline size_t slog_put_escape(char *out, unsigned char c) {
+	static const char hex[] = "0123456789abcdef";
+	out[0] = '\\';
+	out[1] = slog_escape_table[c];
+	if (out[1] != 'u') {
+		return 2;
+	}
+	out[2] = '0';
+	out[3] = '0';
+	out[4] = hex[c >> 4];
+	out[5] = hex[c & 0xf];
+	return 6;
+}
+
+// Writes str quoted and escaped at out, which has room for the worst case
+// of 6 * len + 2 bytes, and returns the end.
+static char *slog_put_escaped(char *out, const char *str, size_t len) {
+	const char *p = str;
+	const char *end = str + len;
+	*out++ = '"';
+	for (;;) {
+		const char *run = slog_escape_scan(p, end);
+		memcpy(out, p, (size_t)(run - p));
+		out += run - p;
+		if (run == end) {
 			break;
-		default:
-			if (c < 0x20) {
-				slog_buffer_append_formatted("\\u%04x", c);
-			} else {
-				slog_buffer_append_formatted("%c", c);
-			}
+		}
+		out += slog_put_escape(out, (unsigned char)*run);
+		p = run + 1;
+	}
+	*out++ = '"';
+	return out;
+}
+
+void slog_write_escape_n(const char *str, size_t len) {
+	const char *p = str;
+	const char *end = str + len;
+
+	// Reserve for the clean case; only escapes need to grow it further.
+	if (!slog_buffer_reserve(len + 2)) {
+		return;
+	}
+	slog_buffer.data[slog_buffer.index++] = '"';
+
+	while (p < end) {
+		const char *run = slog_escape_scan(p, end);
+		memcpy(slog_buffer.data + slog_buffer.index, p, (size_t)(run - p));
+		slog_buffer.index += (size_t)(run - p);
+		if (run == end) {
 			break;
 		}
+
+		// room for the longest sequence plus the rest of the string
+		const size_t room = (size_t)(end - run) + 6;
+		if (slog_buffer.size - slog_buffer.index <= room &&
+		    !slog_buffer_reserve(room)) {
+			return;
+		}
+		slog_buffer.index +=
+			slog_put_escape(slog_buffer.data + slog_buffer.index,
+					(unsigned char)*run);
+		p = run + 1;
+	}
+	slog_buffer.data[slog_buffer.index++] = '"';
+}
+
+void slog_write_escape(const char *str) {
+	assert(str);
+	slog_write_escape_n(str, strlen(str));
+}
+
+static const char slog_digits_lut[200] = {
+	'0', '0', '0', '1', '0', '2', '0', '3', '0', '4', '0', '5', '0', '6',
+	'0', '7', '0', '8', '0', '9', '1', '0', '1', '1', '1', '2', '1', '3',
+	'1', '4', '1', '5', '1', '6', '1', '7', '1', '8', '1', '9', '2', '0',
+	'2', '1', '2', '2', '2', '3', '2', '4', '2', '5', '2', '6', '2', '7',
+	'2', '8', '2', '9', '3', '0', '3', '1', '3', '2', '3', '3', '3', '4',
+	'3', '5', '3', '6', '3', '7', '3', '8', '3', '9', '4', '0', '4', '1',
+	'4', '2', '4', '3', '4', '4', '4', '5', '4', '6', '4', '7', '4', '8',
+	'4', '9', '5', '0', '5', '1', '5', '2', '5', '3', '5', '4', '5', '5',
+	'5', '6', '5', '7', '5', '8', '5', '9', '6', '0', '6', '1', '6', '2',
+	'6', '3', '6', '4', '6', '5', '6', '6', '6', '7', '6', '8', '6', '9',
+	'7', '0', '7', '1', '7', '2', '7', '3', '7', '4', '7', '5', '7', '6',
+	'7', '7', '7', '8', '7', '9', '8', '0', '8', '1', '8', '2', '8', '3',
+	'8', '4', '8', '5', '8', '6', '8', '7', '8', '8', '8', '9', '9', '0',
+	'9', '1', '9', '2', '9', '3', '9', '4', '9', '5', '9', '6', '9', '7',
+	'9', '8', '9', '9',
+};
+
+// Writes the decimal digits of v ending right before end, two at a time.
+// Returns the first digit; callers provide at least 20 bytes.
+static inline char *slog_format_uint(unsigned long long v, char *end) {
+	char *p = end;
+	while (v >= 100) {
+		const unsigned i = (unsigned)(v % 100) * 2;
+		v /= 100;
+		*--p = slog_digits_lut[i + 1];
+		*--p = slog_digits_lut[i];
+	}
+	if (v >= 10) {
+		const unsigned i = (unsigned)v * 2;
+		*--p = slog_digits_lut[i + 1];
+		*--p = slog_digits_lut[i];
+	} else {
+		*--p = (char)('0' + v);
+	}
+	return p;
+}
+
+static inline char *slog_format_int(long long v, char *end) {
+	// negate in unsigned space so LLONG_MIN does not overflow
+	unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v
+				     : (unsigned long long)v;
+	char *p = slog_format_uint(u, end);
+	if (v < 0) {
+		*--p = '-';
+	}
+	return p;
+}
+
+void slog_write_int(long long v) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	char *p = slog_format_int(v, end);
+	slog_buffer_append(p, (size_t)(end - p));
+}
+
+// Shortest round-trip double formatting, Grisu2 after Florian Loitsch,
+// "Printing Floating-Point Numbers Quickly and Accurately with Integers".
+struct slog_diy_fp {
+	uint64_t f;
+	int e;
+};
+
+// Normalized 10^k for k = -348, -340, ..., 340.
+static const struct slog_diy_fp slog_cached_powers[] = {
+	{0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193},
+	{0x8b16fb203055ac76ULL, -1166}, {0xcf42894a5dce35eaULL, -1140},
+	{0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+	{0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034},
+	{0xbe5691ef416bd60cULL, -1007}, {0x8dd01fad907ffc3cULL, -980},
+	{0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+	{0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874},
+	{0x823c12795db6ce57ULL, -847}, {0xc21094364dfb5637ULL, -821},
+	{0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+	{0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715},
+	{0xb23867fb2a35b28eULL, -688}, {0x84c8d4dfd2c63f3bULL, -661},
+	{0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+	{0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555},
+	{0xf3e2f893dec3f126ULL, -529}, {0xb5b5ada8aaff80b8ULL, -502},
+	{0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+	{0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396},
+	{0xa6dfbd9fb8e5b88fULL, -369}, {0xf8a95fcf88747d94ULL, -343},
+	{0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+	{0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236},
+	{0xe45c10c42a2b3b06ULL, -210}, {0xaa242499697392d3ULL, -183},
+	{0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+	{0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77},
+	{0x9c40000000000000ULL, -50}, {0xe8d4a51000000000ULL, -24},
+	{0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+	{0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83},
+	{0xd5d238a4abe98068ULL, 109}, {0x9f4f2726179a2245ULL, 136},
+	{0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+	{0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242},
+	{0x924d692ca61be758ULL, 269}, {0xda01ee641a708deaULL, 295},
+	{0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+	{0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402},
+	{0xc83553c5c8965d3dULL, 428}, {0x952ab45cfa97a0b3ULL, 455},
+	{0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+	{0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561},
+	{0x88fcf317f22241e2ULL, 588}, {0xcc20ce9bd35c78a5ULL, 614},
+	{0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+	{0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720},
+	{0xbb764c4ca7a44410ULL, 747}, {0x8bab8eefb6409c1aULL, 774},
+	{0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+	{0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880},
+	{0x80444b5e7aa7cf85ULL, 907}, {0xbf21e44003acdd2dULL, 933},
+	{0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+	{0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039},
+	{0xaf87023b9bf0ee6bULL, 1066},
+};
+
+static const uint64_t slog_pow10_u64[] = {
+	1ULL,
+	10ULL,
+	100ULL,
+	1000ULL,
+	10000ULL,
+	100000ULL,
+	1000000ULL,
+	10000000ULL,
+	100000000ULL,
+	1000000000ULL,
+	10000000000ULL,
+	100000000000ULL,
+	1000000000000ULL,
+	10000000000000ULL,
+	100000000000000ULL,
+	1000000000000000ULL,
+	10000000000000000ULL,
+	100000000000000000ULL,
+	1000000000000000000ULL,
+	10000000000000000000ULL,
+};
+
+static inline struct slog_diy_fp slog_diy_fp_mul(struct slog_diy_fp x,
+						 struct slog_diy_fp y) {
+	const uint64_t m32 = 0xffffffffULL;
+	const uint64_t a = x.f >> 32, b = x.f & m32;
+	const uint64_t c = y.f >> 32, d = y.f & m32;
+	const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+	tmp += 1ULL << 31; // round
+	struct slog_diy_fp r = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32),
+				x.e + y.e + 64};
+	return r;
+}
+
+static inline struct slog_diy_fp slog_diy_fp_normalize(struct slog_diy_fp x) {
+	while (!(x.f & (1ULL << 63))) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+static inline void slog_grisu_round(char *buf, int len, uint64_t delta,
+				    uint64_t rest, uint64_t ten_kappa,
+				    uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+	       (rest + ten_kappa < wp_w ||
+		wp_w - rest > rest + ten_kappa - wp_w)) {
+		buf[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+// Produces the digits of a finite, positive v into buf (at most 17) and
+// the decimal exponent k so that v == digits * 10^k.
+static int slog_grisu2(double v, char *buf, int *k) {
+	const uint64_t hidden = 1ULL << 52;
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	const int biased_e = (int)((bits >> 52) & 0x7ff);
+	struct slog_diy_fp w = {bits & (hidden - 1), -1074};
+	if (biased_e) {
+		w.f += hidden;
+		w.e = biased_e - 1075;
+	}
+
+	// boundaries m- and m+ halfway to the neighbouring doubles
+	struct slog_diy_fp mp = {(w.f << 1) + 1, w.e - 1};
+	while (!(mp.f & (hidden << 1))) {
+		mp.f <<= 1;
+		mp.e--;
+	}
+	mp.f <<= 64 - 52 - 2;
+	mp.e -= 64 - 52 - 2;
+	struct slog_diy_fp mm = {(w.f << 1) - 1, w.e - 1};
+	if (w.f == hidden) {
+		mm.f = (w.f << 2) - 1;
+		mm.e = w.e - 2;
+	}
+	mm.f <<= mm.e - mp.e;
+	mm.e = mp.e;
+
+	// pick 10^-k so that the scaled exponent lands in [-60, -32]
+	const double dk = (-61 - mp.e) * 0.30102999566398114 + 347;
+	int ck = (int)dk;
+	if (dk - ck > 0.0) {
+		ck++;
+	}
+	const unsigned index = (unsigned)((ck >> 3) + 1);
+	*k = -(-348 + (int)index * 8);
+	const struct slog_diy_fp c = slog_cached_powers[index];
+
+	const struct slog_diy_fp W = slog_diy_fp_mul(slog_diy_fp_normalize(w), c);
+	struct slog_diy_fp Wp = slog_diy_fp_mul(mp, c);
+	struct slog_diy_fp Wm = slog_diy_fp_mul(mm, c);
+	Wm.f++;
+	Wp.f--;
+
+	// digit generation
+	const int shift = -Wp.e;
+	const uint64_t one = 1ULL << shift;
+	const uint64_t wp_w = Wp.f - W.f;
+	uint64_t delta = Wp.f - Wm.f;
+	uint32_t p1 = (uint32_t)(Wp.f >> shift);
+	uint64_t p2 = Wp.f & (one - 1);
+	int kappa = 1;
+	while (kappa < 10 && p1 >= slog_pow10_u64[kappa]) {
+		kappa++;
+	}
+
+	int len = 0;
+	while (kappa > 0) {
+		const uint32_t div = (uint32_t)slog_pow10_u64[kappa - 1];
+		const uint32_t d = p1 / div;
+		p1 %= div;
+		if (d || len) {
+			buf[len++] = (char)('0' + d);
+		}
+		kappa--;
+		const uint64_t rest = ((uint64_t)p1 << shift) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			slog_grisu_round(buf, len, delta, rest,
+					 slog_pow10_u64[kappa] << shift, wp_w);
+			return len;
+		}
+	}
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		const char d = (char)(p2 >> shift);
+		if (d || len) {
+			buf[len++] = (char)('0' + d);
+		}
+		p2 &= one - 1;
+		kappa--;
+		if (p2 < delta) {
+			*k += kappa;
+			const int i = -kappa;
+			slog_grisu_round(buf, len, delta, p2, one,
+					 wp_w * (i < 20 ? slog_pow10_u64[i] : 0));
+			return len;
+		}
+	}
+}
+
+#define SLOG_DOUBLE_MAX 32
+
+// Writes v as JSON to buf, which holds SLOG_DOUBLE_MAX bytes, and returns
+// the length.
+static size_t slog_format_double(double v, char *buf) {
+	// JSON has no NaN or Infinity, keep them readable as strings
+	if (v != v) {
+		memcpy(buf, "\"NaN\"", 5);
+		return 5;
+	}
+	if (v > DBL_MAX || v < -DBL_MAX) {
+		memcpy(buf, v > 0 ? "\"+Inf\"" : "\"-Inf\"", 6);
+		return 6;
+	}
+
+	char *p = buf;
+	if (signbit(v)) {
+		*p++ = '-';
+		v = -v;
+	}
+	if (v == 0) {
+		memcpy(p, "0.0", 3);
+		return (size_t)(p + 3 - buf);
+	}
+
+	int k;
+	const int len = slog_grisu2(v, p, &k);
+	const int kk = len + k; // 10^(kk-1) <= v < 10^kk
+
+	if (k >= 0 && kk <= 21) {
+		// 1234e7 -> 12340000000.0
+		memset(p + len, '0', (size_t)k);
+		memcpy(p + kk, ".0", 2);
+		p += kk + 2;
+	} else if (kk > 0 && kk <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(p + kk + 1, p + kk, (size_t)(len - kk));
+		p[kk] = '.';
+		p += len + 1;
+	} else if (kk > -6 && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		const int offset = 2 - kk;
+		memmove(p + offset, p, (size_t)len);
+		p[0] = '0';
+		p[1] = '.';
+		memset(p + 2, '0', (size_t)(offset - 2));
+		p += len + offset;
+	} else {
+		// 1234e30 -> 1.234e33
+		if (len > 1) {
+			memmove(p + 2, p + 1, (size_t)(len - 1));
+			p[1] = '.';
+			p += len + 1;
+		} else {
+			p += 1;
+		}
+		*p++ = 'e';
+		char exp[24];
+		char *exp_end = exp + sizeof(exp);
+		char *e = slog_format_int(kk - 1, exp_end);
+		memcpy(p, e, (size_t)(exp_end - e));
+		p += exp_end - e;
+	}
+	return (size_t)(p - buf);
+}
+
+void slog_write_double(double v) {
+	char buf[SLOG_DOUBLE_MAX];
+	slog_buffer_append(buf, slog_format_double(v, buf));
+}
+
+// `seconds.` of the last timestamp written by this thread
+static SLOG_THREAD_LOCAL struct {
+	time_t sec;
+	unsigned char len;
+	char text[24];
+} slog_time_cache;
+
+// Writes seconds.microseconds, between quotes when quoted is set.
+#define SLOG_TIME_MAX 32
+
+// Writes the timestamp at out, at most SLOG_TIME_MAX bytes, and returns
+// the end.
+static char *slog_put_time(char *out, const struct timespec *ts,
+			   bool quoted) {
+	if (!slog_time_cache.len || slog_time_cache.sec != ts->tv_sec) {
+		char buf[24];
+		char *end = buf + sizeof(buf);
+		*--end = '.';
+		char *p = slog_format_int((long long)ts->tv_sec, end);
+		slog_time_cache.len = (unsigned char)(buf + sizeof(buf) - p);
+		memcpy(slog_time_cache.text, p, slog_time_cache.len);
+		slog_time_cache.sec = ts->tv_sec;
+	}
+	if (quoted) {
+		*out++ = '"';
+	}
+	memcpy(out, slog_time_cache.text, slog_time_cache.len);
+	out += slog_time_cache.len;
+
+	const unsigned long usec = (unsigned long)ts->tv_nsec / 1000;
+	memcpy(out, &slog_digits_lut[(usec / 10000) * 2], 2);
+	memcpy(out + 2, &slog_digits_lut[(usec / 100 % 100) * 2], 2);
+	memcpy(out + 4, &slog_digits_lut[(usec % 100) * 2], 2);
+	out += 6;
+	if (quoted) {
+		*out++ = '"';
+	}
+	return out;
+}
+
+static void slog_write_time_text(const struct timespec *ts, bool quoted) {
+	if (!slog_buffer_reserve(SLOG_TIME_MAX)) {
+		return;
 	}
-	slog_buffer_append_formatted("\"");
+	char *out = slog_put_time(slog_buffer.data + slog_buffer.index, ts,
+				  quoted);
+	slog_buffer.index = (size_t)(out - slog_buffer.data);
 }
 
 void slog_write_time(struct timespec *ts) {
 	// unix timestamp in seconds.microseconds format (UTC agnostic)
 	// e.g. 1763456783.899468
-	slog_buffer_append_formatted("\"%ld.%06lu\"", ts->tv_sec,
-				     ts->tv_nsec / 1000);
+	slog_write_time_text(ts, true);
+}
+
+static inline void slog_write_key(const char *key, size_t len) {
+	slog_write_escape_n(key, len);
+	slog_buffer_putc(':');
+}
+
+#define SLOG_KEY_CACHE_MAX 1024
+
+// Escaped `"key":` fragments by key pointer. Entries keep a copy of the key
+// so a reused buffer with new contents is re-escaped rather than trusted.
+static SLOG_THREAD_LOCAL struct slog_dict slog_key_cache;
+
+static void slog_key_cache_free(void) {
+	slog_dict_free(&slog_key_cache);
+}
+
+// Writes the `"key":` fragment at out, which has room for 6 * len + 3
+// bytes, and returns the end.
+static char *slog_put_cached_key(char *out, const char *key, size_t len) {
+	struct slog_dict_entry *e = NULL;
+	if (slog_key_cache.count < SLOG_KEY_CACHE_MAX) {
+		e = slog_dict_slot(&slog_key_cache, key, NULL, len);
+	}
+	if (e && e->ptr && !memcmp(e->copy, key, len)) {
+		memcpy(out, e->copy + len, e->fragment_len);
+		return out + e->fragment_len;
+	}
+
+	char *start = out;
+	out = slog_put_escaped(out, key, len);
+	*out++ = ':';
+	const size_t fragment_len = (size_t)(out - start);
+	char *copy;
+	if (!e || !(copy = (char *)malloc(len + fragment_len))) {
+		return out;
+	}
+	memcpy(copy, key, len);
+	memcpy(copy + len, start, fragment_len);
+	if (!e->ptr) {
+		slog_key_cache.count++;
+	}
+	free(e->copy);
+	e->ptr = key;
+	e->n = len;
+	e->copy = copy;
+	e->fragment_len = fragment_len;
+	return out;
+}
+
+static void slog_write_cached_key(const char *key) {
+	const size_t len = strlen(key);
+	if (!slog_buffer_reserve(6 * len + 3)) {
+		return;
+	}
+	char *out = slog_put_cached_key(slog_buffer.data + slog_buffer.index,
+					key, len);
+	slog_buffer.index = (size_t)(out - slog_buffer.data);
+}
+
+// Strings the caller guarantees need no escaping.
+static inline void slog_write_trusted(const char *str) {
+	const size_t len = strlen(str);
+	if (!slog_buffer_reserve(len + 2)) {
+		return;
+	}
+	char *out = slog_buffer.data + slog_buffer.index;
+	out[0] = '"';
+	memcpy(out + 1, str, len);
+	out[len + 1] = '"';
+	slog_buffer.index += len + 2;
+}
+
+static inline void slog_write_bool(bool v) {
+	if (v) {
+		slog_buffer_append("true", 4);
+	} else {
+		slog_buffer_append("false", 5);
+	}
+}
+
+static inline char *slog_put_int(char *out, long long v) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	const char *p = slog_format_int(v, end);
+	memcpy(out, p, (size_t)(end - p));
+	return out + (end - p);
+}
+
+static inline bool slog_node_nested(const struct slog_node *node) {
+	return node->type == SLOG_TYPE_ARRAY || node->type == SLOG_TYPE_OBJECT;
+}
+
+// Strings up to this length are counted at their worst case, six bytes per
+// byte; longer ones are scanned so the reservation stays close to their
+// size.
+#define SLOG_ESCAPE_WORST_CASE 256
+
+static size_t slog_escaped_len(const char *p, size_t len) {
+	if (len <= SLOG_ESCAPE_WORST_CASE) {
+		return len * 6 + 2;
+	}
+	const char *end = p + len;
+	size_t n = len + 2;
+	while ((p = slog_escape_scan(p, end)) < end) {
+		n += slog_escape_table[(unsigned char)*p] == 'u' ? 5 : 1;
+		p++;
+	}
+	return n;
+}
+
+// Upper bound of the JSON written for a node list. Each string is measured
+// once: SLOG_TYPE_STRING nodes become SLOG_TYPE_STRING_N with their length.
+static size_t slog_node_measure(struct slog_node *node) {
+	struct slog_node *parent = NULL;
+	size_t bound = 0;
+	for (;;) {
+		while (node) {
+			bound += 1; // ','
+			if (node->key) {
+				bound += strlen(node->key) * 6 + 3;
+			}
+			switch (node->type) {
+			case SLOG_TYPE_STRING: {
+				const char *str = node->value.string;
+				assert(str);
+				node->type = SLOG_TYPE_STRING_N;
+				node->value.text.data = str;
+				node->value.text.len = strlen(str);
+			}
+				// fall through
+			case SLOG_TYPE_STRING_N:
+				bound += slog_escaped_len(node->value.text.data,
+							  node->value.text.len);
+				break;
+			case SLOG_TYPE_TRUSTED:
+				bound += strlen(node->value.string) + 2;
+				break;
+			case SLOG_TYPE_RAW:
+				bound += node->value.text.len;
+				break;
+			case SLOG_TYPE_BOOL:
+				bound += 5;
+				break;
+			case SLOG_TYPE_INT:
+				bound += 20;
+				break;
+			case SLOG_TYPE_FLOAT:
+				bound += SLOG_DOUBLE_MAX;
+				break;
+			case SLOG_TYPE_TIME:
+				bound += SLOG_TIME_MAX;
+				break;
+			case SLOG_TYPE_ARRAY:
+			case SLOG_TYPE_OBJECT:
+				bound += 2;
+				node->value.nested.parent = parent;
+				parent = node;
+				node = node->value.nested.items;
+				continue;
+			default:
+				break;
+			}
+			node = node->next;
+		}
+		if (!parent) {
+			return bound;
+		}
+		node = parent->next;
+		parent = parent->value.nested.parent;
+	}
+}
+
+// Writes a scalar node's value at out and returns the end.
+static char *slog_put_value(char *out, const struct slog_node *node) {
+	size_t len;
+	switch (node->type) {
+	case SLOG_TYPE_STRING_N:
+		return slog_put_escaped(out, node->value.text.data,
+					node->value.text.len);
+	case SLOG_TYPE_TRUSTED:
+		len = strlen(node->value.string);
+		*out++ = '"';
+		memcpy(out, node->value.string, len);
+		out[len] = '"';
+		return out + len + 1;
+	case SLOG_TYPE_RAW:
+		memcpy(out, node->value.text.data, node->value.text.len);
+		return out + node->value.text.len;
+	case SLOG_TYPE_BOOL:
+		memcpy(out, node->value.boolean ? "true" : "false", 5);
+		return out + (node->value.boolean ? 4 : 5);
+	case SLOG_TYPE_INT:
+		return slog_put_int(out, node->value.integer);
+	case SLOG_TYPE_FLOAT:
+		return out + slog_format_double(node->value.number, out);
+	case SLOG_TYPE_TIME:
+		return slog_put_time(out, &node->value.time, true);
+	default:
+		return out;
+	}
 }
 
+static void slog_node_put_list(struct slog_node *node);
+
+// Writes a node list as JSON members or array items and returns the nodes
+// to the pool. The size is bounded first so the buffer is reserved once,
+// and nesting is walked through the nodes' parent links rather than the
+// C stack, however deep the tree.
 void slog_write_node(struct slog_node *node) {
-	while (node) {
-		struct slog_node *node_defer = node;
-		if (node->key) {
-			slog_write_escape(node->key);
-			slog_buffer_append_formatted(":");
+	if (!slog_buffer_reserve(slog_node_measure(node))) {
+		slog_node_put_list(node);
+		return;
+	}
+	char *out = slog_buffer.data + slog_buffer.index;
+	struct slog_node *parent = NULL;
+	for (;;) {
+		while (node) {
+			if (node->key) {
+				out = slog_put_cached_key(out, node->key,
+							  strlen(node->key));
+			}
+			if (slog_node_nested(node)) {
+				const bool array = node->type == SLOG_TYPE_ARRAY;
+				*out++ = array ? '[' : '{';
+				node->value.nested.parent = parent;
+				parent = node;
+				node = node->value.nested.items;
+				continue;
+			}
+			out = slog_put_value(out, node);
+			struct slog_node *next = node->next;
+			slog_node_put(node);
+			if (next) {
+				*out++ = ',';
+			}
+			node = next;
 		}
-		switch (node->type) {
+		if (!parent) {
+			break;
+		}
+		*out++ = parent->type == SLOG_TYPE_ARRAY ? ']' : '}';
+		node = parent->next;
+		struct slog_node *up = parent->value.nested.parent;
+		slog_node_put(parent);
+		parent = up;
+		if (node) {
+			*out++ = ',';
+		}
+	}
+	slog_buffer.index = (size_t)(out - slog_buffer.data);
+}
+
+// Same output as slog_write_node; keys inside arrays are skipped just like
+// SLOG_ARRAY clears them.
+void slog_write_fields(const struct slog_field *fields, size_t count,
+		       bool keys) {
+	for (size_t i = 0; i < count; i++) {
+		const struct slog_field *field = &fields[i];
+		if (i) {
+			slog_buffer_putc(',');
+		}
+		if (keys && field->key) {
+			slog_write_cached_key(field->key);
+		}
+		switch (field->type) {
 		case SLOG_TYPE_STRING:
-			slog_write_escape(node->value.string);
+			slog_write_escape(field->value.string);
+			break;
+		case SLOG_TYPE_STRING_N:
+			slog_write_escape_n(field->value.text.data,
+					    field->value.text.len);
+			break;
+		case SLOG_TYPE_TRUSTED:
+			slog_write_trusted(field->value.string);
+			break;
+		case SLOG_TYPE_RAW:
+			slog_buffer_append(field->value.text.data,
+					   field->value.text.len);
 			break;
 		case SLOG_TYPE_BOOL:
-			slog_buffer_append_formatted("%s", node->value.boolean ? "true"
-								    : "false");
+			slog_write_bool(field->value.boolean);
 			break;
 		case SLOG_TYPE_INT:
-			slog_buffer_append_formatted("%lld", node->value.integer);
+			slog_write_int(field->value.integer);
 			break;
 		case SLOG_TYPE_FLOAT:
-			slog_buffer_append_formatted("%f", node->value.number);
+			slog_write_double(field->value.number);
 			break;
 		case SLOG_TYPE_ARRAY:
-			slog_buffer_append_formatted("[");
-			slog_write_node(node->value.array);
-			slog_buffer_append_formatted("]");
+			slog_buffer_putc('[');
+			slog_write_fields(field->value.list.items,
+					  field->value.list.count, false);
+			slog_buffer_putc(']');
 			break;
 		case SLOG_TYPE_OBJECT:
-			slog_buffer_append_formatted("{");
-			slog_write_node(node->value.object);
-			slog_buffer_append_formatted("}");
-			break;
-		case SLOG_TYPE_TIME:
-			slog_write_time(&node->value.time);
+			slog_buffer_putc('{');
+			slog_write_fields(field->value.list.items,
+					  field->value.list.count, true);
+			slog_buffer_putc('}');
 			break;
 		default:
 			break;
 		}
-		node = node->next;
-		if (node) {
-			slog_buffer_append_formatted(",");
-		}
-		slog_node_put(node_defer);
 	}
 }
 
-void slog_log_main(const char *file, const int line, const char *func,
-		   const char *level, const char *msg, ...) {
-	va_list nodes;
-	va_start(nodes, msg);
+enum slog_async_policy {
+	SLOG_ASYNC_BLOCK = 0,
+	SLOG_ASYNC_DROP_NEWEST,
+	SLOG_ASYNC_DROP_OLDEST,
+};
 
-	struct slog_node *extra_head = slog_node_make_list(false, nodes);
-	va_end(nodes);
+struct slog_async_config {
+	size_t capacity; // records, rounded up to a power of two
+	size_t batch;    // records written between stdout flushes
+	enum slog_async_policy policy;
+	slog_output_handler_t handler; // NULL keeps the caller's handler
+	slog_writer_t writer;          // used instead of handler when set
+	bool owns;                     // writer keeps the record buffers
+};
 
-	if (strncmp(level, "SLOG_", 5) == 0) {
-		level = level + 5;
-	}
+struct slog_async_stats {
+	unsigned long long enqueued;
+	unsigned long long written;
+	unsigned long long dropped_newest;
+	unsigned long long dropped_oldest;
+};
 
-	struct slog_node *msg_node =
-		slog_node_create(SLOG_TYPE_STRING, "msg", msg);
-	struct slog_node *root = slog_node_create(
-		SLOG_TYPE_OBJECT, NULL,
-		slog_node_create(SLOG_TYPE_STRING, "file", file),
-		slog_node_create(SLOG_TYPE_INT, "line", line),
-		slog_node_create(SLOG_TYPE_STRING, "func", func),
-		slog_node_create(SLOG_TYPE_STRING, "level", level),
-		slog_node_create(SLOG_TYPE_TIME, "time"), msg_node, NULL);
+struct slog_async_slot {
+	size_t seq;
+	char *data;
+	size_t size;
+	size_t len;
+	enum slog_level level;
+	struct timespec time;
+	unsigned sinks; // 0 for the queue's writer
+	int encoding;   // the sinks were chosen for
+};
 
-	if (extra_head) {
-		msg_node->next = extra_head;
-	}
+// Bounded multi-producer ring after Dmitry Vyukov's sequence-numbered
+// queue. Producers never take a lock; the mutex only parks the consumer
+// thread when the ring runs dry and wakes SLOG_FLUSH callers. The consumer
+// swaps each slot buffer with its spare before writing, so a slow handler
+// never pins a slot.
+static pthread_mutex_t slog_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slog_async_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t slog_async_drained = PTHREAD_COND_INITIALIZER;
 
-	if (!slog_buffer_flush_and_reset()) {
-		fprintf(stderr, "Buffer reset failed\n");
-		return;
-	}
-	slog_write_node(root);
-	const char *buffer = slog_buffer_flush_and_reset();
-	if (!buffer) {
-		fprintf(stderr, "Buffer flush failed\n");
-		return;
-	}
+static struct {
+	struct slog_async_slot *slots;
+	size_t mask;
+	char pad0[64];
+	size_t head;
+	char pad1[64];
+	size_t tail;
+	char pad2[64];
+	size_t completed;
+	unsigned long long dropped_newest;
+	unsigned long long dropped_oldest;
+	int sleeping;
+	int waiters;
+	bool running;
 
-	if (slog_output_handler) {
-		slog_output_handler(buffer);
-	} else {
-		fprintf(stdout, "%s\n", buffer);
-		fflush(stdout);
-	}
+	enum slog_async_policy policy;
+	size_t batch;
+	slog_output_handler_t handler;
+	slog_writer_t writer; // NULL writes to stdout
+	bool owns;
+	struct slog_async_slot spare;
+	pthread_t thread;
+	pthread_t owner;
+} slog_async;
+
+static inline bool slog_async_running(void) {
+	return __atomic_load_n(&slog_async.running, __ATOMIC_ACQUIRE);
 }
 
-#define SLOG_BOOL(K, V) slog_node_create(SLOG_TYPE_BOOL, K, V)
-#define SLOG_FLOAT(K, V) slog_node_create(SLOG_TYPE_FLOAT, K, V)
-#define SLOG_STRING(K, V) slog_node_create(SLOG_TYPE_STRING, K, V)
-#define SLOG_INT(K, V) slog_node_create(SLOG_TYPE_INT, K, V)
-#define SLOG_ARRAY_IMPL(K, ...)                                                \
-	slog_node_create(SLOG_TYPE_ARRAY, K, ##__VA_ARGS__, NULL)
-#define SLOG_ARRAY(...) SLOG_ARRAY_IMPL(__VA_ARGS__)
+static bool slog_async_owner(void) {
+	return slog_async_running() &&
+	       pthread_equal(slog_async.owner, pthread_self());
+}
+
+// Claims the slot at *counter once its sequence says it is ready for the
+// enqueue (offset 0) or dequeue (offset 1) side.
+static struct slog_async_slot *slog_async_claim(size_t *counter, size_t *out,
+						 size_t offset) {
+	size_t pos = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	for (;;) {
+		struct slog_async_slot *slot =
+			&slog_async.slots[pos & slog_async.mask];
+		const size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + offset);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(counter, &pos, pos + 1,
+							true, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				*out = pos;
+				return slot;
+			}
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static inline struct slog_async_slot *slog_async_enqueue_slot(size_t *pos) {
+	return slog_async_claim(&slog_async.head, pos, 0);
+}
+
+static inline struct slog_async_slot *slog_async_dequeue_slot(size_t *pos) {
+	return slog_async_claim(&slog_async.tail, pos, 1);
+}
+
+static inline void slog_async_release(struct slog_async_slot *slot,
+				      size_t pos) {
+	__atomic_store_n(&slot->seq, pos + slog_async.mask + 1,
+			 __ATOMIC_RELEASE);
+}
+
+static void slog_async_wake(void) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&slog_async.sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&slog_async_lock);
+		pthread_cond_signal(&slog_async_wakeup);
+		pthread_mutex_unlock(&slog_async_lock);
+	}
+}
+
+static void slog_async_backoff(unsigned *spins) {
+	if (++*spins < 64) {
+		sched_yield();
+	} else {
+		const struct timespec nap = {0, 50000};
+		nanosleep(&nap, NULL);
+	}
+}
+
+static bool slog_async_push(const char *record, size_t len,
+			    enum slog_level level, const struct timespec *time,
+			    unsigned sinks, int encoding) {
+	struct slog_async_slot *slot;
+	size_t pos;
+	unsigned spins = 0;
+
+	while (!(slot = slog_async_enqueue_slot(&pos))) {
+		if (slog_async.policy == SLOG_ASYNC_DROP_NEWEST) {
+			__atomic_fetch_add(&slog_async.dropped_newest, 1,
+					   __ATOMIC_RELAXED);
+			return false;
+		}
+		if (slog_async.policy == SLOG_ASYNC_DROP_OLDEST) {
+			size_t old;
+			struct slog_async_slot *victim =
+				slog_async_dequeue_slot(&old);
+			if (victim) {
+				slog_async_release(victim, old);
+				__atomic_fetch_add(&slog_async.dropped_oldest, 1,
+						   __ATOMIC_RELAXED);
+				__atomic_fetch_add(&slog_async.completed, 1,
+						   __ATOMIC_RELEASE);
+			} else {
+				// the oldest slot is still being filled
+				slog_async_backoff(&spins);
+			}
+			continue;
+		}
+		slog_async_wake();
+		slog_async_backoff(&spins);
+	}
+
+	// Slot buffers are kept across laps, so the steady state is a memcpy.
+	if (slot->size < len + 1) {
+		char *data = (char *)realloc(slot->data, len + 1);
+		if (!data) {
+			len = 0;
+		} else {
+			slot->data = data;
+			slot->size = len + 1;
+		}
+	}
+	if (slot->data) {
+		memcpy(slot->data, record, len);
+		slot->data[len] = '\0';
+	}
+	slot->len = len;
+	slot->level = level;
+	slot->time = *time;
+	slot->sinks = sinks;
+	slot->encoding = encoding;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	slog_async_wake();
+	return true;
+}
+
+static void slog_async_handler_writer(const struct slog_record *record) {
+	slog_async.handler(record->data);
+}
+
+static void slog_async_write(const struct slog_async_slot *slot) {
+	if (!slot->data) {
+		return;
+	}
+	const uint64_t start = slog_stats_sample() ? slog_stats_clock() : 0;
+	const struct slog_record record = {
+		slot->data, slot->len, slot->size, slot->level, slot->time,
+		(enum slog_encoding)slot->encoding};
+	if (slot->sinks) {
+		slog_sinks_write(&record, slot->sinks, slot->encoding);
+	} else if (slog_async.writer) {
+		slog_async.writer(&record);
+	} else {
+		fwrite(slot->data, 1, slot->len, stdout);
+		if (!slog_encoding_binary(slot->encoding)) {
+			fputc('\n', stdout);
+		}
+	}
+	if (start) {
+		slog_stats_handler_time(start);
+	}
+}
+
+static void *slog_async_main(void *arg) {
+	(void)arg;
+	for (;;) {
+		size_t n = 0;
+		size_t pos;
+		struct slog_async_slot *slot;
+
+		while (n < slog_async.batch &&
+		       (slot = slog_async_dequeue_slot(&pos))) {
+			const struct slog_async_slot record = *slot;
+			slot->data = slog_async.spare.data;
+			slot->size = slog_async.spare.size;
+			slog_async_release(slot, pos);
+
+			slog_async.spare = record;
+			slog_async_write(&record);
+			if (slog_async.owns && record.data &&
+			    !slog_record_pool_get(&slog_async.spare.data,
+						  &slog_async.spare.size)) {
+				slog_async.spare.data = NULL;
+				slog_async.spare.size = 0;
+			}
+			n++;
+		}
+		if (n) {
+			if (!slog_async.writer) {
+				fflush(stdout);
+			}
+			__atomic_fetch_add(&slog_async.completed, n,
+					   __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&slog_async.waiters,
+					    __ATOMIC_SEQ_CST)) {
+				pthread_mutex_lock(&slog_async_lock);
+				pthread_cond_broadcast(&slog_async_drained);
+				pthread_mutex_unlock(&slog_async_lock);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&slog_async_lock);
+		__atomic_store_n(&slog_async.sleeping, 1, __ATOMIC_SEQ_CST);
+		const bool idle = __atomic_load_n(&slog_async.tail,
+						  __ATOMIC_SEQ_CST) ==
+				  __atomic_load_n(&slog_async.head,
+						  __ATOMIC_SEQ_CST);
+		if (idle && !slog_async_running()) {
+			__atomic_store_n(&slog_async.sleeping, 0,
+					 __ATOMIC_SEQ_CST);
+			pthread_cond_broadcast(&slog_async_drained);
+			pthread_mutex_unlock(&slog_async_lock);
+			break;
+		}
+		if (idle) {
+			// the timeout only bounds a missed wakeup
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += 10 * 1000 * 1000;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&slog_async_wakeup,
+					       &slog_async_lock, &until);
+		}
+		__atomic_store_n(&slog_async.sleeping, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&slog_async_lock);
+	}
+	return NULL;
+}
+
+// Routes every record of every thread through a background writer.
+// Call SLOG_FREE (or SLOG_ASYNC_STOP) on the same thread to shut it down
+// once the other threads have stopped logging.
+bool SLOG_ASYNC_START(const struct slog_async_config *config) {
+	assert(config);
+	if (slog_async_running()) {
+		return false;
+	}
+
+	size_t capacity = 2;
+	while (capacity < config->capacity && capacity <= SIZE_MAX / 4) {
+		capacity *= 2;
+	}
+	slog_async.slots = (struct slog_async_slot *)calloc(
+		capacity, sizeof(*slog_async.slots));
+	if (!slog_async.slots) {
+		fprintf(stderr, "Async queue allocation failed\n");
+		return false;
+	}
+	for (size_t i = 0; i < capacity; i++) {
+		slog_async.slots[i].seq = i;
+	}
+	slog_async.mask = capacity - 1;
+	slog_async.head = 0;
+	slog_async.tail = 0;
+	slog_async.completed = 0;
+	slog_async.dropped_newest = 0;
+	slog_async.dropped_oldest = 0;
+	slog_async.policy = config->policy;
+	slog_async.batch = config->batch ? config->batch : 64;
+	slog_async.handler = config->handler;
+	slog_async.writer = config->writer;
+	slog_async.owns = config->writer && config->owns;
+	if (!slog_async.writer && slog_async.handler) {
+		slog_async.writer = slog_async_handler_writer;
+	} else if (!slog_async.writer) {
+		slog_async.writer =
+			__atomic_load_n(&slog_writer, __ATOMIC_ACQUIRE);
+		slog_async.owns =
+			__atomic_load_n(&slog_writer_owns, __ATOMIC_RELAXED);
+	}
+	slog_async.owner = pthread_self();
+
+	__atomic_store_n(&slog_async.running, true, __ATOMIC_RELEASE);
+	if (pthread_create(&slog_async.thread, NULL, slog_async_main, NULL)) {
+		fprintf(stderr, "Async writer thread creation failed\n");
+		__atomic_store_n(&slog_async.running, false, __ATOMIC_RELEASE);
+		free(slog_async.slots);
+		slog_async.slots = NULL;
+		return false;
+	}
+	return true;
+}
+
+void SLOG_ASYNC_STATS(struct slog_async_stats *stats) {
+	assert(stats);
+	const size_t head = __atomic_load_n(&slog_async.head, __ATOMIC_RELAXED);
+	const size_t completed =
+		__atomic_load_n(&slog_async.completed, __ATOMIC_RELAXED);
+	stats->dropped_newest =
+		__atomic_load_n(&slog_async.dropped_newest, __ATOMIC_RELAXED);
+	stats->dropped_oldest =
+		__atomic_load_n(&slog_async.dropped_oldest, __ATOMIC_RELAXED);
+	stats->enqueued = head;
+	stats->written = completed - stats->dropped_oldest;
+}
+
+// Blocks until every record logged before the call has been written.
+// Pending "repeated" summaries are written first.
+void SLOG_FLUSH(void) {
+	slog_dedup_sweep(LLONG_MAX);
+	if (slog_binary_target() >= 0) {
+		slog_binary_flush();
+	}
+	if (!slog_async_running()) {
+		fflush(stdout);
+		return;
+	}
+
+	const size_t target = __atomic_load_n(&slog_async.head, __ATOMIC_ACQUIRE);
+	pthread_mutex_lock(&slog_async_lock);
+	__atomic_fetch_add(&slog_async.waiters, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&slog_async.completed, __ATOMIC_SEQ_CST) <
+		       target &&
+	       slog_async_running()) {
+		pthread_cond_signal(&slog_async_wakeup);
+		pthread_cond_wait(&slog_async_drained, &slog_async_lock);
+	}
+	__atomic_fetch_sub(&slog_async.waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&slog_async_lock);
+}
+
+void SLOG_ASYNC_STOP(void) {
+	if (!slog_async_running()) {
+		return;
+	}
+
+	pthread_mutex_lock(&slog_async_lock);
+	__atomic_store_n(&slog_async.running, false, __ATOMIC_RELEASE);
+	pthread_cond_signal(&slog_async_wakeup);
+	pthread_mutex_unlock(&slog_async_lock);
+	pthread_join(slog_async.thread, NULL);
+
+	for (size_t i = 0; i <= slog_async.mask; i++) {
+		free(slog_async.slots[i].data);
+	}
+	free(slog_async.slots);
+	slog_async.slots = NULL;
+	free(slog_async.spare.data);
+	slog_async.spare.data = NULL;
+	slog_async.spare.size = 0;
+}
+
+// Deferred formatting: instead of JSON, records are appended to the thread's
+// slog_buffer as compact binary entries and written to a file descriptor in
+// chunks. Callsites and strings (msg, keys) are sent once per thread through
+// a dictionary; tools/slog-decode turns the stream back into the JSON that
+// slog_write_node would have produced.
+//
+// chunk:  "SLB1" u32le stream-id u32le payload-length payload
+// entry:  'C' id line file func level    callsite definition
+//         'S' id string                  string definition
+//         'R' callsite sec nsec msg-id fields 0
+// field:  type key value                 (nested lists end with 0)
+// key:    0 for none, (id+1)*2 to reference a string, (id+1)*2+1 string
+//         to define one in place
+// Integers are LEB128 varints (zigzag for signed), strings are varint
+// length + bytes, floats are the eight IEEE-754 bytes in little endian.
+#define SLOG_BINARY_MAGIC "SLB1"
+#define SLOG_BINARY_HEADER 12
+#define SLOG_BINARY_CHUNK (64 * 1024)
+
+static int slog_binary_fd = -1;
+static unsigned slog_binary_epoch = 0;
+static unsigned slog_binary_streams = 0;
+static pthread_mutex_t slog_binary_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static SLOG_THREAD_LOCAL struct {
+	unsigned epoch;
+	uint32_t stream;
+	uint32_t next_id;
+	struct slog_dict callsites;
+	struct slog_dict strings;
+} slog_binary_thread;
+
+static inline int slog_binary_target(void) {
+	return __atomic_load_n(&slog_binary_fd, __ATOMIC_ACQUIRE);
+}
+
+static inline void slog_buffer_put_varint(uint64_t v) {
+	if (!slog_buffer_reserve(10)) {
+		return;
+	}
+	char *out = slog_buffer.data + slog_buffer.index;
+	while (v >= 0x80) {
+		*out++ = (char)(v | 0x80);
+		v >>= 7;
+	}
+	*out++ = (char)v;
+	slog_buffer.index = (size_t)(out - slog_buffer.data);
+}
+
+static inline void slog_buffer_put_u32le(char *out, uint32_t v) {
+	for (int i = 0; i < 4; i++) {
+		out[i] = (char)(v >> (8 * i));
+	}
+}
+
+static void slog_binary_reset_thread(void) {
+	slog_dict_free(&slog_binary_thread.callsites);
+	slog_dict_free(&slog_binary_thread.strings);
+	slog_binary_thread.epoch = 0;
+	slog_binary_thread.next_id = 0;
+}
+
+// Writes the thread's pending chunk. Dictionaries start over when a write
+// fails since the decoder never saw the definitions it contained.
+static void slog_binary_flush(void) {
+	const int fd = slog_binary_target();
+	if (slog_buffer.index <= SLOG_BINARY_HEADER ||
+	    slog_binary_thread.epoch !=
+		    __atomic_load_n(&slog_binary_epoch, __ATOMIC_ACQUIRE) ||
+	    fd < 0) {
+		slog_buffer.index = 0;
+		return;
+	}
+
+	slog_buffer_put_u32le(slog_buffer.data + 8,
+			      (uint32_t)(slog_buffer.index - SLOG_BINARY_HEADER));
+	SLOG_COUNT_ADD(bytes, slog_buffer.index);
+	const char *p = slog_buffer.data;
+	size_t left = slog_buffer.index;
+	pthread_mutex_lock(&slog_binary_lock);
+	while (left) {
+		const ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			fprintf(stderr, "Binary log write failed\n");
+			slog_binary_reset_thread();
+			break;
+		}
+		p += n;
+		left -= (size_t)n;
+	}
+	pthread_mutex_unlock(&slog_binary_lock);
+	slog_buffer.index = 0;
+	__atomic_store_n(&slog_thread_memory.binary_len, 0, __ATOMIC_RELEASE);
+}
+
+static void slog_binary_begin_chunk(void) {
+	const unsigned epoch =
+		__atomic_load_n(&slog_binary_epoch, __ATOMIC_ACQUIRE);
+	if (slog_binary_thread.epoch != epoch) {
+		slog_binary_reset_thread();
+		slog_binary_thread.epoch = epoch;
+		slog_binary_thread.stream = __atomic_add_fetch(
+			&slog_binary_streams, 1, __ATOMIC_RELAXED);
+	}
+	slog_buffer.index = 0;
+	if (!slog_buffer_reserve(SLOG_BINARY_HEADER)) {
+		return;
+	}
+	memcpy(slog_buffer.data, SLOG_BINARY_MAGIC, 4);
+	slog_buffer_put_u32le(slog_buffer.data + 4, slog_binary_thread.stream);
+	slog_buffer.index = SLOG_BINARY_HEADER;
+}
+
+static void slog_binary_put_string(const char *str, size_t len) {
+	slog_buffer_put_varint(len);
+	slog_buffer_append(str, len);
+}
+
+// Looks str up in the thread's string dictionary, adding it when missing.
+// Returns whether the decoder has already seen the definition.
+static bool slog_binary_string_id(const char *str, size_t len, uint32_t *id) {
+	struct slog_dict_entry *e =
+		slog_dict_slot(&slog_binary_thread.strings, str, NULL, len);
+	if (e && e->ptr && !memcmp(e->copy, str, len)) {
+		*id = e->id;
+		return true;
+	}
+
+	*id = slog_binary_thread.next_id++;
+	char *copy = (char *)malloc(len + 1);
+	if (e && copy) {
+		memcpy(copy, str, len + 1);
+		if (!e->ptr) {
+			slog_binary_thread.strings.count++;
+		}
+		free(e->copy);
+		e->ptr = str;
+		e->n = len;
+		e->copy = copy;
+		e->id = *id;
+	} else {
+		free(copy);
+	}
+	return false;
+}
+
+static uint32_t slog_binary_callsite_id(const struct slog_callsite *site) {
+	struct slog_dict_entry *e =
+		slog_dict_slot(&slog_binary_thread.callsites, site, NULL, 0);
+	if (e && e->ptr) {
+		return e->id;
+	}
+
+	const uint32_t id = slog_binary_thread.next_id++;
+	if (e) {
+		slog_binary_thread.callsites.count++;
+		e->ptr = site;
+		e->id = id;
+	}
+	const char *level = slog_level_names[site->level];
+	slog_buffer_putc('C');
+	slog_buffer_put_varint(id);
+	slog_buffer_put_varint((uint64_t)site->line);
+	slog_binary_put_string(site->file, strlen(site->file));
+	slog_binary_put_string(site->func, strlen(site->func));
+	slog_binary_put_string(level, strlen(level));
+	return id;
+}
+
+static inline uint64_t slog_zigzag(long long v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static void slog_binary_put_key(const char *key) {
+	if (!key) {
+		slog_buffer_putc(0);
+		return;
+	}
+	const size_t len = strlen(key);
+	uint32_t id;
+	if (slog_binary_string_id(key, len, &id)) {
+		slog_buffer_put_varint(((uint64_t)id + 1) * 2);
+	} else {
+		slog_buffer_put_varint(((uint64_t)id + 1) * 2 + 1);
+		slog_binary_put_string(key, len);
+	}
+}
+
+static void slog_binary_put_double(double v) {
+	uint64_t bits;
+	char raw[8];
+	memcpy(&bits, &v, sizeof(bits));
+	slog_buffer_put_u32le(raw, (uint32_t)bits);
+	slog_buffer_put_u32le(raw + 4, (uint32_t)(bits >> 32));
+	slog_buffer_append(raw, sizeof(raw));
+}
+
+// Encodes a node list the way slog_write_node walks it, releasing nodes.
+// Escaping is a text concern: every string type is stored as a string.
+static inline char slog_binary_type(enum slog_type type) {
+	if (type == SLOG_TYPE_STRING_N || type == SLOG_TYPE_TRUSTED) {
+		return (char)SLOG_TYPE_STRING;
+	}
+	return (char)type;
+}
+
+static void slog_binary_write_node(struct slog_node *node) {
+	struct slog_node *parent = NULL;
+	for (;;) {
+		while (node) {
+			slog_buffer_putc(slog_binary_type(node->type));
+			slog_binary_put_key(node->key);
+
+			switch (node->type) {
+			case SLOG_TYPE_STRING:
+			case SLOG_TYPE_TRUSTED:
+				slog_binary_put_string(
+					node->value.string,
+					strlen(node->value.string));
+				break;
+			case SLOG_TYPE_STRING_N:
+			case SLOG_TYPE_RAW:
+				slog_binary_put_string(node->value.text.data,
+						       node->value.text.len);
+				break;
+			case SLOG_TYPE_INT:
+				slog_buffer_put_varint(
+					slog_zigzag(node->value.integer));
+				break;
+			case SLOG_TYPE_FLOAT:
+				slog_binary_put_double(node->value.number);
+				break;
+			case SLOG_TYPE_BOOL:
+				slog_buffer_putc(node->value.boolean ? 1 : 0);
+				break;
+			case SLOG_TYPE_TIME:
+				slog_buffer_put_varint(
+					(uint64_t)node->value.time.tv_sec);
+				slog_buffer_put_varint(
+					(uint64_t)node->value.time.tv_nsec);
+				break;
+			case SLOG_TYPE_ARRAY:
+			case SLOG_TYPE_OBJECT:
+				// items follow, ended by a 0 tag
+				node->value.nested.parent = parent;
+				parent = node;
+				node = node->value.nested.items;
+				continue;
+			}
+			struct slog_node *next = node->next;
+			slog_node_put(node);
+			node = next;
+		}
+		if (!parent) {
+			return;
+		}
+		slog_buffer_putc(0);
+		node = parent->next;
+		struct slog_node *up = parent->value.nested.parent;
+		slog_node_put(parent);
+		parent = up;
+	}
+}
+
+static void slog_binary_write_fields(const struct slog_field *fields,
+				     size_t count, bool keys) {
+	for (size_t i = 0; i < count; i++) {
+		const struct slog_field *field = &fields[i];
+		slog_buffer_putc(slog_binary_type(field->type));
+		slog_binary_put_key(keys ? field->key : NULL);
+
+		switch (field->type) {
+		case SLOG_TYPE_STRING:
+		case SLOG_TYPE_TRUSTED:
+			slog_binary_put_string(field->value.string,
+					       strlen(field->value.string));
+			break;
+		case SLOG_TYPE_STRING_N:
+		case SLOG_TYPE_RAW:
+			slog_binary_put_string(field->value.text.data,
+					       field->value.text.len);
+			break;
+		case SLOG_TYPE_INT:
+			slog_buffer_put_varint(slog_zigzag(field->value.integer));
+			break;
+		case SLOG_TYPE_FLOAT:
+			slog_binary_put_double(field->value.number);
+			break;
+		case SLOG_TYPE_BOOL:
+			slog_buffer_putc(field->value.boolean ? 1 : 0);
+			break;
+		case SLOG_TYPE_ARRAY:
+		case SLOG_TYPE_OBJECT:
+			slog_binary_write_fields(field->value.list.items,
+						 field->value.list.count,
+						 field->type == SLOG_TYPE_OBJECT);
+			slog_buffer_putc(0);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Starts a record entry; the caller encodes the fields and the final 0.
+static void slog_binary_begin_record(const struct slog_callsite *site,
+				     const char *msg) {
+	struct timespec now;
+	slog_clock_now(&now);
+
+	if (slog_buffer.index < SLOG_BINARY_HEADER ||
+	    slog_binary_thread.epoch !=
+		    __atomic_load_n(&slog_binary_epoch, __ATOMIC_ACQUIRE)) {
+		slog_binary_begin_chunk();
+	}
+	// definitions go out before the record that uses them
+	const uint32_t site_id = slog_binary_callsite_id(site);
+	const size_t msg_len = strlen(msg);
+	uint32_t msg_id;
+	if (!slog_binary_string_id(msg, msg_len, &msg_id)) {
+		slog_buffer_putc('S');
+		slog_buffer_put_varint(msg_id);
+		slog_binary_put_string(msg, msg_len);
+	}
+
+	SLOG_COUNT_ADD(records[site->level], 1);
+	slog_buffer_putc('R');
+	slog_buffer_put_varint(site_id);
+	slog_buffer_put_varint((uint64_t)now.tv_sec);
+	slog_buffer_put_varint((uint64_t)now.tv_nsec);
+	slog_buffer_put_varint(msg_id);
+}
+
+static void slog_stats_report_due(void);
+
+static void slog_binary_end_record(void) {
+	slog_buffer_putc(0);
+	if (slog_buffer.index >= SLOG_BINARY_CHUNK) {
+		slog_binary_flush();
+	} else {
+		__atomic_store_n(&slog_thread_memory.binary_epoch,
+				 slog_binary_thread.epoch, __ATOMIC_RELAXED);
+		__atomic_store_n(&slog_thread_memory.binary_data,
+				 slog_buffer.data, __ATOMIC_RELAXED);
+		__atomic_store_n(&slog_thread_memory.binary_len,
+				 slog_buffer.index, __ATOMIC_RELEASE);
+	}
+	slog_stats_report_due();
+}
+
+// Switches every thread to binary records written to fd (opened by the
+// caller, ideally with O_APPEND). Each thread writes whole chunks once they
+// reach SLOG_BINARY_CHUNK bytes or when it calls SLOG_FLUSH or SLOG_FREE.
+void SLOG_BINARY_START(int fd) {
+	assert(fd >= 0);
+	__atomic_add_fetch(&slog_binary_epoch, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&slog_binary_fd, fd, __ATOMIC_RELEASE);
+}
+
+// Writes the calling thread's pending chunk and returns to JSON output. The
+// caller still owns fd.
+void SLOG_BINARY_STOP(void) {
+	slog_binary_flush();
+	__atomic_store_n(&slog_binary_fd, -1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&slog_binary_epoch, 1, __ATOMIC_ACQ_REL);
+}
+
+// Crash flush. SLOG_CRASH_HANDLER(fd) catches SIGSEGV, SIGBUS, SIGFPE,
+// SIGILL and SIGABRT. The handler only makes async-signal-safe calls: it
+// writes the records still queued for the async writer to fd, each thread's
+// unwritten binary records to the binary log, runs the SLOG_CRASH_HOOK
+// callbacks, ends with a "crash" record on fd, then restores the previous
+// handler and raises the signal again. Other threads keep running
+// meanwhile, so what it finds is a best effort snapshot.
+#define SLOG_CRASH_HOOKS 8
+#define SLOG_CRASH_STACK (64 * 1024)
+
+// Called from the signal handler: async-signal-safe calls only.
+typedef void (*slog_crash_hook_t)(int fd, void *arg);
+
+static const int slog_crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL,
+					 SIGABRT};
+static const char *const slog_crash_names[] = {"SIGSEGV", "SIGBUS", "SIGFPE",
+					       "SIGILL", "SIGABRT"};
+#define SLOG_CRASH_SIGNALS                                                     \
+	(sizeof(slog_crash_signals) / sizeof(slog_crash_signals[0]))
+
+static pthread_mutex_t slog_crash_lock = PTHREAD_MUTEX_INITIALIZER;
+static int slog_crash_fd = -1;
+static struct sigaction slog_crash_previous[SLOG_CRASH_SIGNALS];
+static char *slog_crash_stack = NULL;
+static struct {
+	slog_crash_hook_t hook;
+	void *arg;
+} slog_crash_hooks[SLOG_CRASH_HOOKS];
+
+// write(2) until done or failed; safe in a signal handler.
+static void slog_crash_write(int fd, const void *data, size_t len) {
+	const char *p = (const char *)data;
+	while (len) {
+		const ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+}
+
+// Records published to the queue but not taken by the writer thread yet.
+static void slog_crash_async(int fd) {
+	if (!slog_async_running() || !slog_async.slots) {
+		return;
+	}
+	const bool text = !slog_encoding_binary(
+		__atomic_load_n(&slog_encoding, __ATOMIC_RELAXED));
+	const size_t head = __atomic_load_n(&slog_async.head, __ATOMIC_ACQUIRE);
+	size_t pos = __atomic_load_n(&slog_async.tail, __ATOMIC_ACQUIRE);
+	for (; pos != head; pos++) {
+		const struct slog_async_slot *slot =
+			&slog_async.slots[pos & slog_async.mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1 ||
+		    !slot->data) {
+			continue; // still being filled
+		}
+		slog_crash_write(fd, slot->data, slot->len);
+		if (text) {
+			slog_crash_write(fd, "\n", 1);
+		}
+	}
+}
+
+// Every thread's pending chunk, cut after its last complete record.
+static void slog_crash_binary(void) {
+	const int fd = slog_binary_target();
+	if (fd < 0) {
+		return;
+	}
+	const unsigned epoch =
+		__atomic_load_n(&slog_binary_epoch, __ATOMIC_ACQUIRE);
+	const struct slog_thread_memory *t = slog_memory_threads;
+	for (; t; t = t->next) {
+		const size_t len =
+			__atomic_load_n(&t->binary_len, __ATOMIC_ACQUIRE);
+		const char *data =
+			__atomic_load_n(&t->binary_data, __ATOMIC_RELAXED);
+		if (len <= SLOG_BINARY_HEADER || !data ||
+		    __atomic_load_n(&t->binary_epoch, __ATOMIC_RELAXED) !=
+			    epoch) {
+			continue;
+		}
+		char header[SLOG_BINARY_HEADER];
+		memcpy(header, data, 8);
+		slog_buffer_put_u32le(header + 8,
+				      (uint32_t)(len - SLOG_BINARY_HEADER));
+		slog_crash_write(fd, header, sizeof(header));
+		slog_crash_write(fd, data + SLOG_BINARY_HEADER,
+				 len - SLOG_BINARY_HEADER);
+	}
+}
+
+static char *slog_crash_put(char *out, const char *str) {
+	while (*str) {
+		*out++ = *str++;
+	}
+	return out;
+}
+
+static char *slog_crash_put_uint(char *out, unsigned long long v) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	char *p = slog_format_uint(v, end);
+	memcpy(out, p, (size_t)(end - p));
+	return out + (end - p);
+}
+
+// One JSON line, whatever the encoding: the signal, its code and the
+// faulting address, built on the stack.
+static void slog_crash_record(int fd, size_t index, const siginfo_t *info) {
+	char line[256];
+	char *out = line;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	const unsigned long usec = (unsigned long)now.tv_nsec / 1000;
+
+	out = slog_crash_put(out, "{\"level\":\"ERROR\",\"time\":\"");
+	out = slog_crash_put_uint(out, (unsigned long long)now.tv_sec);
+	*out++ = '.';
+	for (unsigned long d = 100000; d; d /= 10) {
+		*out++ = (char)('0' + usec / d % 10);
+	}
+	out = slog_crash_put(out, "\",\"msg\":\"crash\",\"signal\":\"");
+	out = slog_crash_put(out, slog_crash_names[index]);
+	out = slog_crash_put(out, "\",\"code\":");
+	if (info->si_code < 0) {
+		*out++ = '-';
+	}
+	out = slog_crash_put_uint(
+		out, (unsigned long long)(info->si_code < 0 ? -info->si_code
+							    : info->si_code));
+	out = slog_crash_put(out, ",\"addr\":\"0x");
+	const uintptr_t addr = (uintptr_t)info->si_addr;
+	int shift = (int)sizeof(addr) * 8 - 4;
+	while (shift > 0 && !(addr >> shift & 0xf)) {
+		shift -= 4;
+	}
+	for (; shift >= 0; shift -= 4) {
+		*out++ = "0123456789abcdef"[addr >> shift & 0xf];
+	}
+	out = slog_crash_put(out, "\",\"pid\":");
+	out = slog_crash_put_uint(out, (unsigned long long)getpid());
+	out = slog_crash_put(out, "}\n");
+	slog_crash_write(fd, line, (size_t)(out - line));
+}
+
+static void slog_crash_signal(int sig, siginfo_t *info, void *context) {
+	(void)context;
+	static int entered = 0;
+	const int saved_errno = errno;
+	size_t index = 0;
+	while (index < SLOG_CRASH_SIGNALS - 1 &&
+	       slog_crash_signals[index] != sig) {
+		index++;
+	}
+	// a second crashing thread goes straight to the previous handler
+	if (!__atomic_exchange_n(&entered, 1, __ATOMIC_ACQ_REL)) {
+		const int fd = __atomic_load_n(&slog_crash_fd, __ATOMIC_ACQUIRE);
+		if (fd >= 0) {
+			slog_crash_async(fd);
+		}
+		slog_crash_binary();
+		for (int i = 0; i < SLOG_CRASH_HOOKS; i++) {
+			const slog_crash_hook_t hook = __atomic_load_n(
+				&slog_crash_hooks[i].hook, __ATOMIC_ACQUIRE);
+			void *arg = __atomic_load_n(&slog_crash_hooks[i].arg,
+						    __ATOMIC_RELAXED);
+			if (hook) {
+				hook(fd, arg);
+			}
+		}
+		if (fd >= 0) {
+			slog_crash_record(fd, index, info);
+		}
+	}
+	// delivered again once this handler returns
+	sigaction(sig, &slog_crash_previous[index], NULL);
+	errno = saved_errno;
+	raise(sig);
+}
+
+// Installs the crash handler, writing to fd (opened by the caller and kept
+// open); a negative fd puts the previous handlers back. The calling thread
+// also gets an alternate signal stack, so a stack overflow is reported.
+bool SLOG_CRASH_HANDLER(int fd) {
+	pthread_mutex_lock(&slog_crash_lock);
+	const bool installed =
+		__atomic_load_n(&slog_crash_fd, __ATOMIC_RELAXED) >= 0;
+	if (fd < 0) {
+		for (size_t i = 0; installed && i < SLOG_CRASH_SIGNALS; i++) {
+			sigaction(slog_crash_signals[i], &slog_crash_previous[i],
+				  NULL);
+		}
+		__atomic_store_n(&slog_crash_fd, -1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&slog_crash_lock);
+		return true;
+	}
+	__atomic_store_n(&slog_crash_fd, fd, __ATOMIC_RELEASE);
+	if (installed) {
+		pthread_mutex_unlock(&slog_crash_lock);
+		return true;
+	}
+
+	stack_t stack;
+	if (sigaltstack(NULL, &stack) == 0 && (stack.ss_flags & SS_DISABLE)) {
+		if (!slog_crash_stack) {
+			slog_crash_stack = (char *)malloc(SLOG_CRASH_STACK);
+		}
+		if (slog_crash_stack) {
+			stack.ss_sp = slog_crash_stack;
+			stack.ss_size = SLOG_CRASH_STACK;
+			stack.ss_flags = 0;
+			sigaltstack(&stack, NULL);
+		}
+	}
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = slog_crash_signal;
+	action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	bool ok = true;
+	for (size_t i = 0; i < SLOG_CRASH_SIGNALS; i++) {
+		if (sigaction(slog_crash_signals[i], &action,
+			      &slog_crash_previous[i]) != 0) {
+			fprintf(stderr, "Crash handler installation failed\n");
+			ok = false;
+		}
+	}
+	pthread_mutex_unlock(&slog_crash_lock);
+	return ok;
+}
+
+// Adds a callback that writes what a queue of the caller's still holds.
+// Returns false when all SLOG_CRASH_HOOKS are taken.
+bool SLOG_CRASH_HOOK(slog_crash_hook_t hook, void *arg) {
+	assert(hook);
+	pthread_mutex_lock(&slog_crash_lock);
+	for (int i = 0; i < SLOG_CRASH_HOOKS; i++) {
+		if (!slog_crash_hooks[i].hook) {
+			__atomic_store_n(&slog_crash_hooks[i].arg, arg,
+					 __ATOMIC_RELAXED);
+			__atomic_store_n(&slog_crash_hooks[i].hook, hook,
+					 __ATOMIC_RELEASE);
+			pthread_mutex_unlock(&slog_crash_lock);
+			return true;
+		}
+	}
+	pthread_mutex_unlock(&slog_crash_lock);
+	return false;
+}
+
+void SLOG_CRASH_UNHOOK(slog_crash_hook_t hook, void *arg) {
+	pthread_mutex_lock(&slog_crash_lock);
+	for (int i = 0; i < SLOG_CRASH_HOOKS; i++) {
+		if (slog_crash_hooks[i].hook == hook &&
+		    slog_crash_hooks[i].arg == arg) {
+			__atomic_store_n(&slog_crash_hooks[i].hook, NULL,
+					 __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&slog_crash_lock);
+}
+
+// Racing threads build identical prefixes; the first one published wins.
+static void slog_callsite_publish_prefix(struct slog_callsite *site,
+					 const char *data, size_t len) {
+	char *copy = (char *)malloc(len);
+	if (!copy) {
+		return;
+	}
+	memcpy(copy, data, len);
+	const char *expected = NULL;
+	__atomic_store_n(&site->prefix_len, len, __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&site->prefix, &expected, copy, false,
+					 __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		free(copy);
+	}
+}
+
+// Writes the fixed fields straight from the callsite instead of building
+// nodes for them; the output matches slog_write_node on the same fields.
+// Everything before the timestamp is serialized once per callsite and
+// copied from then on.
+static void slog_write_header(struct slog_callsite *site, const char *msg,
+			      const struct timespec *now) {
+	const char *prefix = __atomic_load_n(&site->prefix, __ATOMIC_ACQUIRE);
+	if (prefix) {
+		slog_buffer_append(prefix, site->prefix_len);
+	} else {
+		const size_t start = slog_buffer.index;
+		slog_buffer_putc('{');
+		slog_write_key("file", 4);
+		slog_write_escape(site->file);
+		slog_buffer_putc(',');
+		slog_write_key("line", 4);
+		slog_write_int(site->line);
+		slog_buffer_putc(',');
+		slog_write_key("func", 4);
+		slog_write_escape(site->func);
+		slog_buffer_putc(',');
+		slog_write_key("level", 5);
+		slog_write_escape(slog_level_names[site->level]);
+		slog_buffer_putc(',');
+		slog_write_key("time", 4);
+		slog_callsite_publish_prefix(site, slog_buffer.data + start,
+					     slog_buffer.index - start);
+	}
+	slog_write_time_text(now, true);
+	slog_record_body = slog_buffer.index;
+	slog_buffer_append(",\"msg\":", 7);
+	slog_write_escape(msg);
+}
+
+// Gives this thread's buffer away to an owning writer; the next record
+// starts with a released one, if there is any.
+static void slog_buffer_hand_off(void) {
+	SLOG_STAT_ADD(buffer_bytes, 0 - slog_buffer.size);
+	slog_buffer.data = NULL;
+	slog_buffer.size = 0;
+}
+
+// Duplicate suppression. With a window set, a record whose body (msg and
+// fields: everything after the time) hashes like the last one written from
+// the same callsite less than the window earlier is only counted. When the
+// window is over, the callsite logs one "repeated" record with the count and
+// the times of the first and last suppressed repeat. Binary records are not
+// deduplicated.
+static long long slog_dedup_window = 0; // ns, 0 = off
+static pthread_mutex_t slog_dedup_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slog_callsite *slog_dedup_pending = NULL;
+static long long slog_dedup_due = LLONG_MAX; // first pending window end
+
+// A summary taken by the record that ended its window, written after it.
+static SLOG_THREAD_LOCAL struct {
+	struct slog_callsite *site;
+	unsigned long long repeats;
+	long long first;
+	long long last;
+	bool writing;
+} slog_dedup_thread;
+
+// 64-bit multiply-xorshift over 8-byte words; not for untrusted keys.
+static uint64_t slog_hash_bytes(const char *p, size_t len) {
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+	uint64_t w;
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+	w = 0;
+	memcpy(&w, p, len);
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+	return h ^ h >> 29;
+}
+
+static inline long long slog_timespec_ns(const struct timespec *ts) {
+	return (long long)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void slog_dedup_acquire(struct slog_dedup *d) {
+	unsigned spins = 0;
+	while (__atomic_exchange_n(&d->lock, true, __ATOMIC_ACQUIRE)) {
+		if (++spins >= 64) {
+			sched_yield();
+		}
+	}
+}
+
+static void slog_dedup_release(struct slog_dedup *d) {
+	__atomic_store_n(&d->lock, false, __ATOMIC_RELEASE);
+}
+
+static void slog_dedup_queue(struct slog_callsite *site, long long end) {
+	pthread_mutex_lock(&slog_dedup_lock);
+	site->dedup.next = slog_dedup_pending;
+	slog_dedup_pending = site;
+	if (end < __atomic_load_n(&slog_dedup_due, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&slog_dedup_due, end, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&slog_dedup_lock);
+}
+
+// Returns whether the record in slog_buffer repeats the callsite's last one.
+static bool slog_dedup_suppress(struct slog_callsite *site, long long now,
+				long long window) {
+	const uint64_t hash =
+		slog_hash_bytes(slog_buffer.data + slog_record_body,
+				slog_buffer.index - slog_record_body);
+	struct slog_dedup *d = &site->dedup;
+	bool queue = false;
+	slog_dedup_acquire(d);
+	const long long end = d->start + window;
+	const bool repeat = d->hash == hash && d->start && now < end;
+	if (repeat) {
+		if (!d->repeats++) {
+			d->first = now;
+			queue = !d->queued;
+			d->queued = true;
+		}
+		d->last = now;
+	} else {
+		if (d->repeats) {
+			slog_dedup_thread.site = site;
+			slog_dedup_thread.repeats = d->repeats;
+			slog_dedup_thread.first = d->first;
+			slog_dedup_thread.last = d->last;
+			d->repeats = 0;
+		}
+		d->hash = hash;
+		d->start = now;
+	}
+	slog_dedup_release(d);
+	if (queue) {
+		slog_dedup_queue(site, end);
+	}
+	return repeat;
+}
+
+static struct slog_node *slog_time_node(const char *key, long long ns) {
+	struct slog_node *node = slog_node_create(SLOG_TYPE_TIME, key);
+	node->value.time.tv_sec = (time_t)(ns / 1000000000);
+	node->value.time.tv_nsec = (long)(ns % 1000000000);
+	return node;
+}
+
+void slog_log_main(struct slog_callsite *site, const char *msg, ...);
+
+static void slog_dedup_report(struct slog_callsite *site,
+			      unsigned long long repeats, long long first,
+			      long long last) {
+	slog_dedup_thread.writing = true;
+	slog_log_main(site, "repeated",
+		      slog_node_create(SLOG_TYPE_INT, "count",
+				       (long long)repeats),
+		      slog_time_node("first", first),
+		      slog_time_node("last", last), NULL);
+	slog_dedup_thread.writing = false;
+}
+
+// Writes the summaries of the windows that ended by now, one at a time so
+// that no lock is held while logging.
+static void slog_dedup_sweep(long long now) {
+	const long long window =
+		__atomic_load_n(&slog_dedup_window, __ATOMIC_RELAXED);
+	for (;;) {
+		struct slog_callsite *found = NULL;
+		unsigned long long repeats = 0;
+		long long first = 0, last = 0;
+		long long due = LLONG_MAX;
+		pthread_mutex_lock(&slog_dedup_lock);
+		struct slog_callsite **link = &slog_dedup_pending;
+		while (*link) {
+			struct slog_callsite *site = *link;
+			struct slog_dedup *d = &site->dedup;
+			slog_dedup_acquire(d);
+			const long long end = d->start + window;
+			if (!found && (!window || end <= now || !d->repeats)) {
+				found = site;
+				repeats = d->repeats;
+				first = d->first;
+				last = d->last;
+				d->repeats = 0;
+				d->queued = false;
+				*link = d->next;
+				slog_dedup_release(d);
+				continue;
+			}
+			if (end < due) {
+				due = end;
+			}
+			slog_dedup_release(d);
+			link = &d->next;
+		}
+		__atomic_store_n(&slog_dedup_due, due, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&slog_dedup_lock);
+		if (!found) {
+			return;
+		}
+		if (repeats) {
+			slog_dedup_report(found, repeats, first, last);
+		}
+	}
+}
+
+// Runs after each record: writes the summary it took over, if any, and the
+// summaries of windows that have ended.
+static void slog_dedup_after(long long now) {
+	if (slog_dedup_thread.site) {
+		struct slog_callsite *ended = slog_dedup_thread.site;
+		slog_dedup_thread.site = NULL;
+		slog_dedup_report(ended, slog_dedup_thread.repeats,
+				  slog_dedup_thread.first,
+				  slog_dedup_thread.last);
+	}
+	if (__atomic_load_n(&slog_dedup_due, __ATOMIC_RELAXED) <= now) {
+		slog_dedup_sweep(now);
+	}
+}
+
+// Sets the window in milliseconds; 0 turns suppression off and writes the
+// pending summaries.
+void SLOG_SET_DEDUP(unsigned window_ms) {
+	__atomic_store_n(&slog_dedup_window, (long long)window_ms * 1000000,
+			 __ATOMIC_RELAXED);
+	if (!window_ms) {
+		slog_dedup_sweep(LLONG_MAX);
+	}
+}
+
+// Terminates the pass in slog_buffer and hands it to its output. Returns
+// false when the record is suppressed and no other pass should be written.
+static bool slog_emit(struct slog_callsite *site, const struct timespec *time,
+		      const struct slog_pass *pass) {
+	const enum slog_level level = site->level;
+	const long long window =
+		__atomic_load_n(&slog_dedup_window, __ATOMIC_RELAXED);
+	if (window && pass->count == 1 && !slog_dedup_thread.writing &&
+	    slog_dedup_suppress(site, slog_timespec_ns(time), window)) {
+		slog_buffer.index = 0;
+		return false;
+	}
+	const size_t len = slog_buffer.index;
+	const char *buffer = slog_buffer_flush_and_reset();
+	if (!buffer) {
+		fprintf(stderr, "Buffer flush failed\n");
+		return false;
+	}
+	if (pass->count == 1) {
+		SLOG_COUNT_ADD(records[level], 1);
+	}
+	SLOG_COUNT_ADD(bytes, len);
+
+	// the async writer times its own handler calls
+	const bool async = slog_async_running();
+	const uint64_t start =
+		!async && slog_stats_sample() ? slog_stats_clock() : 0;
+	slog_writer_t writer;
+	if (async) {
+		slog_async_push(buffer, len, level, time, pass->sinks,
+				pass->encoding);
+	} else if (pass->sinks) {
+		const struct slog_record record = {
+			slog_buffer.data, len, slog_buffer.size, level, *time,
+			(enum slog_encoding)pass->encoding};
+		slog_sinks_write(&record, pass->sinks, pass->encoding);
+	} else if ((writer = __atomic_load_n(&slog_writer, __ATOMIC_ACQUIRE))) {
+		const struct slog_record record = {
+			slog_buffer.data, len, slog_buffer.size, level, *time,
+			(enum slog_encoding)pass->encoding};
+		if (__atomic_load_n(&slog_writer_owns, __ATOMIC_RELAXED)) {
+			slog_buffer_hand_off();
+		}
+		writer(&record);
+	} else {
+		fwrite(buffer, 1, len, stdout);
+		if (!slog_encoding_binary(pass->encoding)) {
+			fputc('\n', stdout);
+		}
+		fflush(stdout);
+	}
+	if (start) {
+		slog_stats_handler_time(start);
+	}
+	slog_buffer_trim(len);
+	if (pass->todo) {
+		return true;
+	}
+	slog_stats_report_due();
+	if (window && !slog_dedup_thread.writing) {
+		slog_dedup_after(slog_timespec_ns(time));
+	}
+	return true;
+}
+
+// Self-report: every few seconds the first record to notice logs a summary
+// of SLOG_STATS through the normal path, so it can be filtered by level or
+// module ("slog") like any other record.
+static unsigned slog_stats_report_seconds = 0;
+static long long slog_stats_report_next = 0;
+static SLOG_THREAD_LOCAL bool slog_stats_reporting = false;
+
+void SLOG_STATS_REPORT(unsigned seconds) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	__atomic_store_n(&slog_stats_report_next,
+			 (long long)now.tv_sec + seconds, __ATOMIC_RELAXED);
+	__atomic_store_n(&slog_stats_report_seconds, seconds,
+			 __ATOMIC_RELAXED);
+}
+
+// Upper bound of the bucket holding the given fraction of samples.
+static unsigned long long slog_stats_percentile(const struct slog_stats *s,
+						unsigned long long samples,
+						double fraction) {
+	unsigned long long seen = 0;
+	for (int i = 0; i < SLOG_STATS_BUCKETS; i++) {
+		seen += s->handler_ns[i];
+		if (samples && seen >= samples * fraction) {
+			return 128ull << i;
+		}
+	}
+	return 0;
+}
+
+static struct slog_node *slog_stat_node(const char *key,
+					unsigned long long v) {
+	return slog_node_create(SLOG_TYPE_INT, key, (long long)v);
+}
+
+static void slog_stats_report(void) {
+	static struct slog_callsite site = SLOG_CALLSITE_INIT(SLOG_INFO);
+	if (!slog_callsite_enabled(&site)) {
+		return;
+	}
+	struct slog_stats s;
+	SLOG_STATS(&s);
+	unsigned long long samples = 0;
+	for (int i = 0; i < SLOG_STATS_BUCKETS; i++) {
+		samples += s.handler_ns[i];
+	}
+	slog_log_main(
+		&site, "slog stats",
+		slog_node_create(SLOG_TYPE_OBJECT, "records",
+				 slog_stat_node("error", s.records[SLOG_ERROR]),
+				 slog_stat_node("warn", s.records[SLOG_WARN]),
+				 slog_stat_node("info", s.records[SLOG_INFO]),
+				 slog_stat_node("debug", s.records[SLOG_DEBUG]),
+				 NULL),
+		slog_node_create(SLOG_TYPE_OBJECT, "filtered",
+				 slog_stat_node("error", s.filtered[SLOG_ERROR]),
+				 slog_stat_node("warn", s.filtered[SLOG_WARN]),
+				 slog_stat_node("info", s.filtered[SLOG_INFO]),
+				 slog_stat_node("debug", s.filtered[SLOG_DEBUG]),
+				 NULL),
+		slog_stat_node("bytes", s.bytes),
+		slog_stat_node("reallocs", s.reallocs),
+		slog_stat_node("pool_misses", s.pool_misses),
+		slog_stat_node("handler_samples", samples),
+		slog_stat_node("handler_p50_ns",
+				slog_stats_percentile(&s, samples, 0.5)),
+		slog_stat_node("handler_p99_ns",
+				slog_stats_percentile(&s, samples, 0.99)),
+		NULL);
+}
+
+static void slog_stats_report_due(void) {
+	const unsigned seconds =
+		__atomic_load_n(&slog_stats_report_seconds, __ATOMIC_RELAXED);
+	if (!seconds || slog_stats_reporting) {
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	long long next =
+		__atomic_load_n(&slog_stats_report_next, __ATOMIC_RELAXED);
+	if (now.tv_sec < next ||
+	    !__atomic_compare_exchange_n(&slog_stats_report_next, &next,
+					 (long long)now.tv_sec + seconds,
+					 false, __ATOMIC_RELAXED,
+					 __ATOMIC_RELAXED)) {
+		return;
+	}
+	slog_stats_reporting = true;
+	slog_stats_report();
+	slog_stats_reporting = false;
+}
+
+// Fields bound to a logger; NULL when logging without one.
+struct slog_logger;
+static void slog_logger_write(const struct slog_logger *logger);
+static void slog_logger_write_binary(const struct slog_logger *logger);
+static void slog_encode_record(int encoding, const struct slog_callsite *site,
+			       const char *msg, const struct timespec *now,
+			       const struct slog_logger *logger,
+			       struct slog_node *nodes,
+			       const struct slog_field *fields, size_t count);
+
+static void slog_log_nodes(struct slog_callsite *site,
+			   const struct slog_logger *logger, const char *msg,
+			   struct slog_node *extra_head) {
+	if (slog_binary_target() >= 0) {
+		slog_binary_begin_record(site, msg);
+		slog_logger_write_binary(logger);
+		slog_binary_write_node(extra_head);
+		slog_binary_end_record();
+		return;
+	}
+
+	struct timespec now;
+	slog_clock_now(&now);
+	struct slog_pass pass;
+	slog_pass_begin(&pass, site->level);
+	while (slog_pass_next(&pass)) {
+		if (!slog_buffer_flush_and_reset()) {
+			fprintf(stderr, "Buffer reset failed\n");
+			break;
+		}
+		if (pass.encoding != SLOG_ENCODING_JSON) {
+			slog_encode_record(pass.encoding, site, msg, &now,
+					   logger, extra_head, NULL, 0);
+			if (!slog_emit(site, &now, &pass)) {
+				break;
+			}
+			continue;
+		}
+		slog_write_header(site, msg, &now);
+		slog_logger_write(logger);
+		if (extra_head) {
+			slog_buffer_putc(',');
+			slog_write_node(extra_head); // puts the nodes back
+			extra_head = NULL;
+		}
+		slog_buffer_putc('}');
+		slog_emit(site, &now, &pass);
+	}
+	slog_node_put_list(extra_head);
+}
+
+void slog_log_main(struct slog_callsite *site, const char *msg, ...) {
+	va_list nodes;
+	va_start(nodes, msg);
+	struct slog_node *extra_head = slog_node_make_list(false, nodes);
+	va_end(nodes);
+	slog_log_nodes(site, NULL, msg, extra_head);
+}
+
+void slog_log_with(struct slog_callsite *site,
+		   const struct slog_logger *logger, const char *msg, ...) {
+	va_list nodes;
+	va_start(nodes, msg);
+	struct slog_node *extra_head = slog_node_make_list(false, nodes);
+	va_end(nodes);
+	slog_log_nodes(site, logger, msg, extra_head);
+}
+
+void slog_log_fields(struct slog_callsite *site, const char *msg,
+		     const struct slog_field *fields, size_t count) {
+	if (slog_binary_target() >= 0) {
+		slog_binary_begin_record(site, msg);
+		slog_binary_write_fields(fields, count, true);
+		slog_binary_end_record();
+		return;
+	}
+
+	struct timespec now;
+	slog_clock_now(&now);
+	struct slog_pass pass;
+	slog_pass_begin(&pass, site->level);
+	while (slog_pass_next(&pass)) {
+		if (!slog_buffer_flush_and_reset()) {
+			fprintf(stderr, "Buffer reset failed\n");
+			return;
+		}
+		if (pass.encoding != SLOG_ENCODING_JSON) {
+			slog_encode_record(pass.encoding, site, msg, &now,
+					   NULL, NULL, fields, count);
+		} else {
+			slog_write_header(site, msg, &now);
+			if (count) {
+				slog_buffer_putc(',');
+				slog_write_fields(fields, count, true);
+			}
+			slog_buffer_putc('}');
+		}
+		if (!slog_emit(site, &now, &pass)) {
+			return;
+		}
+	}
+}
+
+// For front ends that serialize fields themselves, like slog.hpp: starts a
+// JSON record in slog_buffer, up to and including msg. Returns false when
+// records are binary or need another encoding; slog_log_fields takes them.
+bool slog_json_begin(struct slog_callsite *site, const char *msg,
+		     struct timespec *now, struct slog_pass *pass) {
+	if (slog_binary_target() >= 0) {
+		return false;
+	}
+	slog_pass_begin(pass, site->level);
+	if (!slog_pass_next(pass) || pass->todo ||
+	    pass->encoding != SLOG_ENCODING_JSON ||
+	    !slog_buffer_flush_and_reset()) {
+		return false;
+	}
+	slog_clock_now(now);
+	slog_write_header(site, msg, now);
+	return true;
+}
+
+void slog_json_end(struct slog_callsite *site, const struct timespec *now,
+		   const struct slog_pass *pass) {
+	slog_buffer_putc('}');
+	slog_emit(site, now, pass);
+}
+
+// Bound fields are serialized to JSON once, when the logger is created.
+// Binary records need them as values, so a deep copy is kept as well.
+struct slog_logger {
+	char *json; // `"key":value,...` without braces
+	size_t json_len;
+	struct slog_field *fields;
+	size_t count;
+};
+
+static void slog_logger_write(const struct slog_logger *logger) {
+	if (logger && logger->json_len) {
+		slog_buffer_putc(',');
+		slog_buffer_append(logger->json, logger->json_len);
+	}
+}
+
+static void slog_logger_write_binary(const struct slog_logger *logger) {
+	if (logger) {
+		slog_binary_write_fields(logger->fields, logger->count, true);
+	}
+}
+
+static void slog_node_put_list(struct slog_node *node) {
+	struct slog_node *parent = NULL;
+	for (;;) {
+		while (node) {
+			if (slog_node_nested(node)) {
+				node->value.nested.parent = parent;
+				parent = node;
+				node = node->value.nested.items;
+				continue;
+			}
+			struct slog_node *next = node->next;
+			slog_node_put(node);
+			node = next;
+		}
+		if (!parent) {
+			return;
+		}
+		node = parent->next;
+		struct slog_node *up = parent->value.nested.parent;
+		slog_node_put(parent);
+		parent = up;
+	}
+}
+
+static void slog_fields_free_lists(struct slog_field *fields, size_t count) {
+	for (size_t i = 0; fields && i < count; i++) {
+		if (fields[i].type == SLOG_TYPE_ARRAY ||
+		    fields[i].type == SLOG_TYPE_OBJECT) {
+			slog_fields_free_lists(
+				(struct slog_field *)fields[i].value.list.items,
+				fields[i].value.list.count);
+		}
+	}
+	free(fields);
+}
+
+// Views a node list as fields without copying strings. SLOG_TYPE_TIME has
+// no field equivalent and is left out.
+static struct slog_field *slog_fields_from_nodes(const struct slog_node *node,
+						 size_t *count) {
+	size_t n = 0;
+	for (const struct slog_node *p = node; p; p = p->next) {
+		n += p->type != SLOG_TYPE_TIME;
+	}
+	*count = 0;
+	struct slog_field *fields =
+		(struct slog_field *)calloc(n ? n : 1, sizeof(*fields));
+	if (!fields) {
+		return NULL;
+	}
+	for (; node; node = node->next) {
+		struct slog_field *field = &fields[*count];
+		field->type = node->type;
+		field->key = node->key;
+		switch (node->type) {
+		case SLOG_TYPE_STRING:
+		case SLOG_TYPE_TRUSTED:
+			field->value.string = node->value.string;
+			break;
+		case SLOG_TYPE_STRING_N:
+		case SLOG_TYPE_RAW:
+			field->value.text.data = node->value.text.data;
+			field->value.text.len = node->value.text.len;
+			break;
+		case SLOG_TYPE_INT:
+			field->value.integer = node->value.integer;
+			break;
+		case SLOG_TYPE_FLOAT:
+			field->value.number = node->value.number;
+			break;
+		case SLOG_TYPE_BOOL:
+			field->value.boolean = node->value.boolean;
+			break;
+		case SLOG_TYPE_ARRAY:
+		case SLOG_TYPE_OBJECT:
+			field->value.list.items = slog_fields_from_nodes(
+				node->type == SLOG_TYPE_ARRAY ? node->value.array
+							      : node->value.object,
+				&field->value.list.count);
+			break;
+		case SLOG_TYPE_TIME:
+			continue;
+		}
+		(*count)++;
+	}
+	return fields;
+}
+
+static void slog_fields_measure(const struct slog_field *fields, size_t count,
+				size_t *total, size_t *bytes) {
+	*total += count;
+	for (size_t i = 0; i < count; i++) {
+		const struct slog_field *field = &fields[i];
+		*bytes += field->key ? strlen(field->key) + 1 : 0;
+		if (field->type == SLOG_TYPE_STRING ||
+		    field->type == SLOG_TYPE_TRUSTED) {
+			*bytes += strlen(field->value.string) + 1;
+		} else if (field->type == SLOG_TYPE_STRING_N ||
+			   field->type == SLOG_TYPE_RAW) {
+			*bytes += field->value.text.len + 1;
+		} else if (field->type == SLOG_TYPE_ARRAY ||
+			   field->type == SLOG_TYPE_OBJECT) {
+			slog_fields_measure(field->value.list.items,
+					    field->value.list.count, total,
+					    bytes);
+		}
+	}
+}
+
+struct slog_fields_arena {
+	struct slog_field *fields;
+	char *bytes;
+};
+
+static const char *slog_arena_copy(struct slog_fields_arena *arena,
+				   const char *data, size_t len) {
+	char *copy = arena->bytes;
+	memcpy(copy, data, len);
+	copy[len] = '\0';
+	arena->bytes += len + 1;
+	return copy;
+}
+
+static const char *slog_arena_strdup(struct slog_fields_arena *arena,
+				     const char *str) {
+	return str ? slog_arena_copy(arena, str, strlen(str)) : NULL;
+}
+
+// Copies fields into dst, taking nested lists and strings from the arena.
+static void slog_fields_clone(struct slog_fields_arena *arena,
+			      struct slog_field *dst,
+			      const struct slog_field *src, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		dst[i] = src[i];
+		dst[i].key = slog_arena_strdup(arena, src[i].key);
+		if (src[i].type == SLOG_TYPE_STRING ||
+		    src[i].type == SLOG_TYPE_TRUSTED) {
+			dst[i].value.string =
+				slog_arena_strdup(arena, src[i].value.string);
+		} else if (src[i].type == SLOG_TYPE_STRING_N ||
+			   src[i].type == SLOG_TYPE_RAW) {
+			dst[i].value.text.data =
+				slog_arena_copy(arena, src[i].value.text.data,
+						src[i].value.text.len);
+		} else if (src[i].type == SLOG_TYPE_ARRAY ||
+			   src[i].type == SLOG_TYPE_OBJECT) {
+			struct slog_field *items = arena->fields;
+			arena->fields += src[i].value.list.count;
+			slog_fields_clone(arena, items, src[i].value.list.items,
+					  src[i].value.list.count);
+			dst[i].value.list.items = items;
+		}
+	}
+}
+
+void SLOG_LOGGER_FREE(struct slog_logger *logger) {
+	if (!logger) {
+		return;
+	}
+	free(logger->json);
+	free(logger->fields);
+	free(logger);
+}
+
+static bool slog_logger_build(struct slog_logger *logger,
+			      const struct slog_logger *parent,
+			      const struct slog_field *own, size_t own_count) {
+	// the fragment is written from the caller's strings, so keys hit the
+	// same cache as the callsites using them
+	if (!slog_buffer_flush_and_reset()) {
+		return false;
+	}
+	if (parent && parent->json_len) {
+		slog_buffer_append(parent->json, parent->json_len);
+		if (own_count) {
+			slog_buffer_putc(',');
+		}
+	}
+	slog_write_fields(own, own_count, true);
+	logger->json_len = slog_buffer.index;
+	slog_buffer.index = 0;
+	logger->json = (char *)malloc(logger->json_len + 1);
+	if (!logger->json) {
+		return false;
+	}
+	memcpy(logger->json, slog_buffer.data, logger->json_len);
+	logger->json[logger->json_len] = '\0';
+
+	const size_t parent_count = parent ? parent->count : 0;
+	size_t total = 0;
+	size_t bytes = 0;
+	if (parent) {
+		slog_fields_measure(parent->fields, parent_count, &total, &bytes);
+	}
+	slog_fields_measure(own, own_count, &total, &bytes);
+	logger->fields = (struct slog_field *)malloc(
+		(total ? total : 1) * sizeof(struct slog_field) + bytes);
+	if (!logger->fields) {
+		return false;
+	}
+	logger->count = parent_count + own_count;
+	struct slog_fields_arena arena = {logger->fields + logger->count,
+					  (char *)(logger->fields + total)};
+	if (parent) {
+		slog_fields_clone(&arena, logger->fields, parent->fields,
+				  parent_count);
+	}
+	slog_fields_clone(&arena, logger->fields + parent_count, own,
+			  own_count);
+	return true;
+}
+
+// Creates a logger whose records carry the parent's fields followed by the
+// given ones. The parent may be freed before its children.
+struct slog_logger *slog_logger_new(const struct slog_logger *parent, ...) {
+	va_list nodes;
+	va_start(nodes, parent);
+	struct slog_node *head = slog_node_make_list(false, nodes);
+	va_end(nodes);
+
+	size_t own_count;
+	struct slog_field *own = slog_fields_from_nodes(head, &own_count);
+	struct slog_logger *logger =
+		(struct slog_logger *)calloc(1, sizeof(*logger));
+	if (!own || !logger ||
+	    !slog_logger_build(logger, parent, own, own_count)) {
+		fprintf(stderr, "Logger allocation failed\n");
+		SLOG_LOGGER_FREE(logger);
+		logger = NULL;
+	}
+	slog_fields_free_lists(own, own_count);
+	slog_node_put_list(head);
+	return logger;
+}
+
+
+// Encoders other than JSON are driven through these primitives by one walk
+// over the header, the logger's fields and the record's own fields. JSON
+// keeps its specialized writer with cached keys and prefixes.
+struct slog_encoder {
+	void (*begin)(size_t count); // the record is a map of count members
+	void (*key)(const char *key, size_t len);
+	void (*item)(void); // before each array element, may be NULL
+	void (*string)(const char *str, size_t len);
+	void (*integer)(long long v);
+	void (*number)(double v);
+	void (*boolean)(bool v);
+	void (*time)(const struct timespec *ts);
+	void (*open)(bool object, size_t count);
+	void (*close)(void); // may be NULL
+};
+
+static inline void slog_buffer_put_be(uint64_t v, int bytes) {
+	if (!slog_buffer_reserve((size_t)bytes)) {
+		return;
+	}
+	char *out = slog_buffer.data + slog_buffer.index;
+	for (int i = bytes - 1; i >= 0; i--) {
+		out[i] = (char)(v & 0xff);
+		v >>= 8;
+	}
+	slog_buffer.index += (size_t)bytes;
+}
+
+static inline uint64_t slog_double_bits(double v) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	return bits;
+}
+
+// CBOR (RFC 8949): definite lengths, shortest integer heads, float64
+// numbers and epoch-based date/time (tag 1) timestamps.
+static void slog_cbor_head(unsigned major, uint64_t v) {
+	const char type = (char)(major << 5);
+	if (v < 24) {
+		slog_buffer_putc((char)(type | (char)v));
+	} else if (v <= 0xff) {
+		slog_buffer_putc((char)(type | 24));
+		slog_buffer_put_be(v, 1);
+	} else if (v <= 0xffff) {
+		slog_buffer_putc((char)(type | 25));
+		slog_buffer_put_be(v, 2);
+	} else if (v <= 0xffffffffu) {
+		slog_buffer_putc((char)(type | 26));
+		slog_buffer_put_be(v, 4);
+	} else {
+		slog_buffer_putc((char)(type | 27));
+		slog_buffer_put_be(v, 8);
+	}
+}
+
+static void slog_cbor_begin(size_t count) {
+	slog_cbor_head(5, count);
+}
+
+static void slog_cbor_string(const char *str, size_t len) {
+	slog_cbor_head(3, len);
+	slog_buffer_append(str, len);
+}
+
+static void slog_cbor_integer(long long v) {
+	if (v >= 0) {
+		slog_cbor_head(0, (uint64_t)v);
+	} else {
+		slog_cbor_head(1, (uint64_t)(-1 - v));
+	}
+}
+
+static void slog_cbor_number(double v) {
+	slog_buffer_putc((char)0xfb);
+	slog_buffer_put_be(slog_double_bits(v), 8);
+}
+
+static void slog_cbor_boolean(bool v) {
+	slog_buffer_putc(v ? (char)0xf5 : (char)0xf4);
+}
+
+static void slog_cbor_time(const struct timespec *ts) {
+	slog_buffer_putc((char)0xc1);
+	slog_cbor_number((double)ts->tv_sec + ts->tv_nsec / 1e9);
+}
+
+static void slog_cbor_open(bool object, size_t count) {
+	slog_cbor_head(object ? 5 : 4, count);
+}
+
+// MessagePack: the smallest format for every value and the timestamp
+// extension type (-1) for times.
+static void slog_msgpack_size(size_t n, char fix, size_t fix_max, char m16,
+			      char m32) {
+	if (n <= fix_max) {
+		slog_buffer_putc((char)(fix | (char)n));
+	} else if (n <= 0xffff) {
+		slog_buffer_putc(m16);
+		slog_buffer_put_be(n, 2);
+	} else {
+		slog_buffer_putc(m32);
+		slog_buffer_put_be(n, 4);
+	}
+}
+
+static void slog_msgpack_begin(size_t count) {
+	slog_msgpack_size(count, (char)0x80, 15, (char)0xde, (char)0xdf);
+}
+
+static void slog_msgpack_string(const char *str, size_t len) {
+	if (len > 31 && len <= 0xff) {
+		slog_buffer_putc((char)0xd9);
+		slog_buffer_put_be(len, 1);
+	} else {
+		slog_msgpack_size(len, (char)0xa0, 31, (char)0xda, (char)0xdb);
+	}
+	slog_buffer_append(str, len);
+}
+
+static void slog_msgpack_integer(long long v) {
+	if (v >= 0) {
+		const uint64_t u = (uint64_t)v;
+		if (u <= 0x7f) {
+			slog_buffer_putc((char)u);
+		} else if (u <= 0xff) {
+			slog_buffer_putc((char)0xcc);
+			slog_buffer_put_be(u, 1);
+		} else if (u <= 0xffff) {
+			slog_buffer_putc((char)0xcd);
+			slog_buffer_put_be(u, 2);
+		} else if (u <= 0xffffffffu) {
+			slog_buffer_putc((char)0xce);
+			slog_buffer_put_be(u, 4);
+		} else {
+			slog_buffer_putc((char)0xcf);
+			slog_buffer_put_be(u, 8);
+		}
+	} else if (v >= -32) {
+		slog_buffer_putc((char)v);
+	} else if (v >= INT8_MIN) {
+		slog_buffer_putc((char)0xd0);
+		slog_buffer_put_be((uint64_t)v, 1);
+	} else if (v >= INT16_MIN) {
+		slog_buffer_putc((char)0xd1);
+		slog_buffer_put_be((uint64_t)v, 2);
+	} else if (v >= INT32_MIN) {
+		slog_buffer_putc((char)0xd2);
+		slog_buffer_put_be((uint64_t)v, 4);
+	} else {
+		slog_buffer_putc((char)0xd3);
+		slog_buffer_put_be((uint64_t)v, 8);
+	}
+}
+
+static void slog_msgpack_number(double v) {
+	slog_buffer_putc((char)0xcb);
+	slog_buffer_put_be(slog_double_bits(v), 8);
+}
+
+static void slog_msgpack_boolean(bool v) {
+	slog_buffer_putc(v ? (char)0xc3 : (char)0xc2);
+}
+
+static void slog_msgpack_time(const struct timespec *ts) {
+	const uint64_t sec = (uint64_t)ts->tv_sec;
+	const uint64_t nsec = (uint64_t)ts->tv_nsec;
+	if (ts->tv_sec >= 0 && sec >> 34 == 0) {
+		slog_buffer_append("\xd7\xff", 2); // timestamp 64
+		slog_buffer_put_be(nsec << 34 | sec, 8);
+	} else {
+		slog_buffer_append("\xc7\x0c\xff", 3); // timestamp 96
+		slog_buffer_put_be(nsec, 4);
+		slog_buffer_put_be(sec, 8);
+	}
+}
+
+static void slog_msgpack_open(bool object, size_t count) {
+	if (object) {
+		slog_msgpack_begin(count);
+	} else {
+		slog_msgpack_size(count, (char)0x90, 15, (char)0xdc,
+				  (char)0xdd);
+	}
+}
+
+// logfmt: one line of key=value pairs. Nested objects and arrays are
+// flattened into dotted keys (user.id=1 ids.0=7), and values are quoted
+// and escaped like JSON strings only when they need to be.
+#define SLOG_LOGFMT_DEPTH 32
+
+static SLOG_THREAD_LOCAL struct {
+	char path[256];
+	size_t len;
+	size_t prefix[SLOG_LOGFMT_DEPTH];
+	bool array[SLOG_LOGFMT_DEPTH];
+	size_t items[SLOG_LOGFMT_DEPTH]; // next array index
+	unsigned depth;
+	unsigned overflow; // levels deeper than SLOG_LOGFMT_DEPTH
+	bool first;
+} slog_logfmt;
+
+static void slog_logfmt_path(const char *part, size_t len) {
+	slog_logfmt.len = slog_logfmt.prefix[slog_logfmt.depth];
+	if (slog_logfmt.len && slog_logfmt.len < sizeof(slog_logfmt.path)) {
+		slog_logfmt.path[slog_logfmt.len++] = '.';
+	}
+	for (size_t i = 0;
+	     i < len && slog_logfmt.len < sizeof(slog_logfmt.path); i++) {
+		const unsigned char c = (unsigned char)part[i];
+		const bool plain = c > ' ' && c != '=' && c != '"' && c != 0x7f;
+		slog_logfmt.path[slog_logfmt.len++] = plain ? (char)c : '_';
+	}
+}
+
+static void slog_logfmt_pair(void) {
+	if (!slog_logfmt.first) {
+		slog_buffer_putc(' ');
+	}
+	slog_logfmt.first = false;
+	slog_buffer_append(slog_logfmt.path, slog_logfmt.len);
+	slog_buffer_putc('=');
+}
+
+static void slog_logfmt_begin(size_t count) {
+	(void)count;
+	slog_logfmt.len = 0;
+	slog_logfmt.prefix[0] = 0;
+	slog_logfmt.array[0] = false;
+	slog_logfmt.depth = 0;
+	slog_logfmt.overflow = 0;
+	slog_logfmt.first = true;
+}
+
+static void slog_logfmt_key(const char *key, size_t len) {
+	slog_logfmt_path(key, len);
+}
+
+static void slog_logfmt_item(void) {
+	if (!slog_logfmt.array[slog_logfmt.depth]) {
+		return;
+	}
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	char *p = slog_format_uint(slog_logfmt.items[slog_logfmt.depth]++, end);
+	slog_logfmt_path(p, (size_t)(end - p));
+}
+
+static void slog_logfmt_string(const char *str, size_t len) {
+	slog_logfmt_pair();
+	bool quote = !len;
+	for (size_t i = 0; i < len && !quote; i++) {
+		const unsigned char c = (unsigned char)str[i];
+		quote = c <= ' ' || c == '"' || c == '=' || c == '\\' ||
+			c == 0x7f;
+	}
+	if (quote) {
+		slog_write_escape_n(str, len);
+	} else {
+		slog_buffer_append(str, len);
+	}
+}
+
+static void slog_logfmt_integer(long long v) {
+	slog_logfmt_pair();
+	slog_write_int(v);
+}
+
+static void slog_logfmt_number(double v) {
+	slog_logfmt_pair();
+	slog_write_double(v);
+}
+
+static void slog_logfmt_boolean(bool v) {
+	slog_logfmt_pair();
+	slog_write_bool(v);
+}
+
+static void slog_logfmt_time(const struct timespec *ts) {
+	slog_logfmt_pair();
+	slog_write_time_text(ts, false);
+}
+
+static void slog_logfmt_open(bool object, size_t count) {
+	if (!count) {
+		slog_logfmt_pair();
+		slog_buffer_append(object ? "{}" : "[]", 2);
+	}
+	if (slog_logfmt.depth + 1 == SLOG_LOGFMT_DEPTH) {
+		slog_logfmt.overflow++;
+		return;
+	}
+	slog_logfmt.depth++;
+	slog_logfmt.prefix[slog_logfmt.depth] = slog_logfmt.len;
+	slog_logfmt.array[slog_logfmt.depth] = !object;
+	slog_logfmt.items[slog_logfmt.depth] = 0;
+}
+
+static void slog_logfmt_close(void) {
+	if (slog_logfmt.overflow) {
+		slog_logfmt.overflow--;
+	} else {
+		slog_logfmt.depth--;
+	}
+}
+
+static const struct slog_encoder slog_encoder_logfmt = {
+	slog_logfmt_begin,  slog_logfmt_key,     slog_logfmt_item,
+	slog_logfmt_string, slog_logfmt_integer, slog_logfmt_number,
+	slog_logfmt_boolean, slog_logfmt_time,   slog_logfmt_open,
+	slog_logfmt_close,
+};
+
+static const struct slog_encoder slog_encoder_cbor = {
+	slog_cbor_begin,   slog_cbor_string, NULL,
+	slog_cbor_string,  slog_cbor_integer, slog_cbor_number,
+	slog_cbor_boolean, slog_cbor_time,   slog_cbor_open,
+	NULL,
+};
+
+static const struct slog_encoder slog_encoder_msgpack = {
+	slog_msgpack_begin,   slog_msgpack_string,  NULL,
+	slog_msgpack_string,  slog_msgpack_integer, slog_msgpack_number,
+	slog_msgpack_boolean, slog_msgpack_time,    slog_msgpack_open,
+	NULL,
+};
+
+static size_t slog_node_count(const struct slog_node *node) {
+	size_t count = 0;
+	for (; node; node = node->next) {
+		count++;
+	}
+	return count;
+}
+
+static void slog_encode_string(const struct slog_encoder *enc,
+			       const char *str) {
+	enc->string(str, strlen(str));
+}
+
+// Keys inside arrays are skipped, as in slog_write_node. Nesting is walked
+// through the nodes' parent links, like slog_write_node, but the list is
+// left intact for the passes that follow.
+static void slog_encode_nodes(const struct slog_encoder *enc,
+			      struct slog_node *node, bool keys) {
+	struct slog_node *parent = NULL;
+	for (;;) {
+		while (node) {
+			if (parent ? parent->type == SLOG_TYPE_OBJECT : keys) {
+				const char *key = node->key ? node->key : "";
+				enc->key(key, strlen(key));
+			} else if (enc->item) {
+				enc->item();
+			}
+			switch (node->type) {
+			case SLOG_TYPE_STRING:
+			case SLOG_TYPE_TRUSTED:
+				slog_encode_string(enc, node->value.string);
+				break;
+			case SLOG_TYPE_STRING_N:
+			case SLOG_TYPE_RAW:
+				enc->string(node->value.text.data,
+					    node->value.text.len);
+				break;
+			case SLOG_TYPE_BOOL:
+				enc->boolean(node->value.boolean);
+				break;
+			case SLOG_TYPE_INT:
+				enc->integer(node->value.integer);
+				break;
+			case SLOG_TYPE_FLOAT:
+				enc->number(node->value.number);
+				break;
+			case SLOG_TYPE_TIME:
+				enc->time(&node->value.time);
+				break;
+			case SLOG_TYPE_ARRAY:
+			case SLOG_TYPE_OBJECT:
+				enc->open(node->type == SLOG_TYPE_OBJECT,
+					  slog_node_count(
+						  node->value.nested.items));
+				node->value.nested.parent = parent;
+				parent = node;
+				node = node->value.nested.items;
+				continue;
+			default:
+				break;
+			}
+			node = node->next;
+		}
+		if (!parent) {
+			return;
+		}
+		if (enc->close) {
+			enc->close();
+		}
+		node = parent->next;
+		parent = parent->value.nested.parent;
+	}
+}
+
+static void slog_encode_fields(const struct slog_encoder *enc,
+			       const struct slog_field *fields, size_t count,
+			       bool keys) {
+	for (size_t i = 0; i < count; i++) {
+		const struct slog_field *field = &fields[i];
+		if (keys) {
+			const char *key = field->key ? field->key : "";
+			enc->key(key, strlen(key));
+		} else if (enc->item) {
+			enc->item();
+		}
+		switch (field->type) {
+		case SLOG_TYPE_STRING:
+		case SLOG_TYPE_TRUSTED:
+			slog_encode_string(enc, field->value.string);
+			break;
+		case SLOG_TYPE_STRING_N:
+		case SLOG_TYPE_RAW:
+			enc->string(field->value.text.data,
+				    field->value.text.len);
+			break;
+		case SLOG_TYPE_BOOL:
+			enc->boolean(field->value.boolean);
+			break;
+		case SLOG_TYPE_INT:
+			enc->integer(field->value.integer);
+			break;
+		case SLOG_TYPE_FLOAT:
+			enc->number(field->value.number);
+			break;
+		case SLOG_TYPE_ARRAY:
+		case SLOG_TYPE_OBJECT: {
+			const bool object = field->type == SLOG_TYPE_OBJECT;
+			enc->open(object, field->value.list.count);
+			slog_encode_fields(enc, field->value.list.items,
+					   field->value.list.count, object);
+			if (enc->close) {
+				enc->close();
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+// Encodes a whole record into slog_buffer: the members of the JSON header
+// in the same order, then the logger's fields, then nodes or fields.
+static void slog_encode_record(int encoding, const struct slog_callsite *site,
+			       const char *msg, const struct timespec *now,
+			       const struct slog_logger *logger,
+			       struct slog_node *nodes,
+			       const struct slog_field *fields, size_t count) {
+	const struct slog_encoder *enc =
+		encoding == SLOG_ENCODING_CBOR      ? &slog_encoder_cbor
+		: encoding == SLOG_ENCODING_MSGPACK ? &slog_encoder_msgpack
+						    : &slog_encoder_logfmt;
+	const size_t bound = logger ? logger->count : 0;
+	enc->begin(6 + bound + (nodes ? slog_node_count(nodes) : count));
+	enc->key("file", 4);
+	slog_encode_string(enc, site->file);
+	enc->key("line", 4);
+	enc->integer(site->line);
+	enc->key("func", 4);
+	slog_encode_string(enc, site->func);
+	enc->key("level", 5);
+	slog_encode_string(enc, slog_level_names[site->level]);
+	enc->key("time", 4);
+	enc->time(now);
+	slog_record_body = slog_buffer.index;
+	enc->key("msg", 3);
+	slog_encode_string(enc, msg);
+
+	if (bound) {
+		slog_encode_fields(enc, logger->fields, bound, true);
+	}
+	slog_encode_nodes(enc, nodes, true);
+	slog_encode_fields(enc, fields, count, true);
+}
+
+// Per-callsite state of SLOG_SAMPLED and SLOG_RATELIMIT. Only relaxed
+// atomics are used: a rejected call costs one or two of them.
+struct slog_limiter {
+	unsigned long long calls;
+	unsigned long long suppressed; // rejected since the last record
+	uint64_t next;                 // GCRA theoretical arrival time, ns
+};
+
+static inline bool slog_limiter_reject(struct slog_limiter *l) {
+	__atomic_fetch_add(&l->suppressed, 1, __ATOMIC_RELAXED);
+	return false;
+}
+
+// Returns and resets the number of rejected calls.
+static inline long long slog_limiter_take(struct slog_limiter *l) {
+	return (long long)__atomic_exchange_n(&l->suppressed, 0,
+					      __ATOMIC_RELAXED);
+}
+
+static inline bool slog_sample(struct slog_limiter *l, unsigned long long n) {
+	if (n > 1 && __atomic_fetch_add(&l->calls, 1, __ATOMIC_RELAXED) % n) {
+		return slog_limiter_reject(l);
+	}
+	return true;
+}
+
+// Token bucket as a generic cell rate algorithm: one timestamp per
+// callsite, allowing `per_second` records with bursts of `burst`.
+static inline bool slog_ratelimit(struct slog_limiter *l,
+				  unsigned long per_second, unsigned burst) {
+	if (!per_second) {
+		return slog_limiter_reject(l);
+	}
+	const uint64_t interval = 1000000000ULL / per_second;
+	const uint64_t tolerance = interval * (burst ? burst : 1);
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	const uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL +
+			     (uint64_t)ts.tv_nsec;
+
+	uint64_t next = __atomic_load_n(&l->next, __ATOMIC_RELAXED);
+	uint64_t start;
+	do {
+		start = next > now ? next : now;
+		if (start + interval - now > tolerance) {
+			return slog_limiter_reject(l);
+		}
+	} while (!__atomic_compare_exchange_n(&l->next, &next,
+					      start + interval, true,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+	return true;
+}
+
+// casts match what slog_node_vcreate reads back with va_arg
+#define SLOG_BOOL(K, V) slog_node_create(SLOG_TYPE_BOOL, K, (int)(V))
+#define SLOG_FLOAT(K, V) slog_node_create(SLOG_TYPE_FLOAT, K, (double)(V))
+#define SLOG_STRING(K, V) slog_node_create(SLOG_TYPE_STRING, K, V)
+#define SLOG_STRING_N(K, V, N)                                                 \
+	slog_node_create(SLOG_TYPE_STRING_N, K, (const char *)(V), (size_t)(N))
+#define SLOG_TRUSTED(K, V) slog_node_create(SLOG_TYPE_TRUSTED, K, V)
+#define SLOG_RAW(K, V, N)                                                      \
+	slog_node_create(SLOG_TYPE_RAW, K, (const char *)(V), (size_t)(N))
+#define SLOG_INT(K, V) slog_node_create(SLOG_TYPE_INT, K, (long long)(V))
+#define SLOG_ARRAY_IMPL(K, ...)                                                \
+	slog_node_create(SLOG_TYPE_ARRAY, K, ##__VA_ARGS__, NULL)
+#define SLOG_ARRAY(...) SLOG_ARRAY_IMPL(__VA_ARGS__)
 
 #define SLOG_OBJECT_IMPL(K, ...)                                               \
 	slog_node_create(SLOG_TYPE_OBJECT, K, ##__VA_ARGS__, NULL)
 #define SLOG_OBJECT(...) SLOG_OBJECT_IMPL(__VA_ARGS__)
 
+// LEVEL must be one of the enum constants: it is checked against
+// SLOG_MIN_LEVEL at compile time and stored in the static callsite.
 #define SLOG(LEVEL, MSG, ...)                                                  \
 	do {                                                                   \
-		if (slog_level_should_log(LEVEL)) {                          \
-			slog_log_main(__FILE__, __LINE__, __func__, #LEVEL,  \
-				      MSG, ##__VA_ARGS__, NULL);           \
+		if ((LEVEL) <= SLOG_MIN_LEVEL) {                               \
+			static struct slog_callsite slog_callsite =            \
+				SLOG_CALLSITE_INIT(LEVEL);                     \
+			if (slog_callsite_enabled(&slog_callsite)) {           \
+				slog_log_main(&slog_callsite, MSG,             \
+					      ##__VA_ARGS__, NULL);            \
+			}                                                      \
+		}                                                              \
+	} while (0)
+
+// A logger with bound fields, serialized once and copied into each record:
+//
+//   struct slog_logger *req = SLOG_LOGGER(NULL, SLOG_STRING("req", id));
+//   struct slog_logger *db = SLOG_LOGGER(req, SLOG_STRING("db", name));
+//   SLOG_WITH(db, SLOG_INFO, "query", SLOG_INT("rows", n));
+//   SLOG_LOGGER_FREE(db);
+#define SLOG_LOGGER(PARENT, ...) slog_logger_new(PARENT, ##__VA_ARGS__, NULL)
+
+#define SLOG_WITH(LOGGER, LEVEL, MSG, ...)                                     \
+	do {                                                                   \
+		if ((LEVEL) <= SLOG_MIN_LEVEL) {                               \
+			static struct slog_callsite slog_callsite =            \
+				SLOG_CALLSITE_INIT(LEVEL);                     \
+			if (slog_callsite_enabled(&slog_callsite)) {           \
+				slog_log_with(&slog_callsite, LOGGER, MSG,     \
+					      ##__VA_ARGS__, NULL);            \
+			}                                                      \
+		}                                                              \
+	} while (0)
+
+// Emit one call in N; the others only bump a counter.
+//
+//   SLOG_SAMPLED(SLOG_DEBUG, 100, "cache miss", SLOG_STRING("key", key));
+#define SLOG_SAMPLED(LEVEL, N, MSG, ...)                                       \
+	do {                                                                   \
+		if ((LEVEL) <= SLOG_MIN_LEVEL) {                               \
+			static struct slog_limiter slog_limiter;               \
+			static struct slog_callsite slog_callsite =            \
+				SLOG_CALLSITE_INIT(LEVEL);                     \
+			if (slog_callsite_enabled(&slog_callsite) &&           \
+			    slog_sample(&slog_limiter, N)) {                   \
+				slog_log_main(                                 \
+					&slog_callsite, MSG, ##__VA_ARGS__,    \
+					SLOG_INT("suppressed",                 \
+						 slog_limiter_take(            \
+							 &slog_limiter)),      \
+					NULL);                                 \
+			}                                                      \
+		}                                                              \
+	} while (0)
+
+// At most PER_SECOND records per second on average, BURST at once.
+//
+//   SLOG_RATELIMIT(SLOG_WARN, 10, 20, "queue full", SLOG_INT("len", n));
+#define SLOG_RATELIMIT(LEVEL, PER_SECOND, BURST, MSG, ...)                     \
+	do {                                                                   \
+		if ((LEVEL) <= SLOG_MIN_LEVEL) {                               \
+			static struct slog_limiter slog_limiter;               \
+			static struct slog_callsite slog_callsite =            \
+				SLOG_CALLSITE_INIT(LEVEL);                     \
+			if (slog_callsite_enabled(&slog_callsite) &&           \
+			    slog_ratelimit(&slog_limiter, PER_SECOND,          \
+					   BURST)) {                           \
+				slog_log_main(                                 \
+					&slog_callsite, MSG, ##__VA_ARGS__,    \
+					SLOG_INT("suppressed",                 \
+						 slog_limiter_take(            \
+							 &slog_limiter)),      \
+					NULL);                                 \
+			}                                                      \
+		}                                                              \
+	} while (0)
+
+// Allocation-free front-end: fields are compound literals that live in the
+// caller's frame, so a record touches no node pool and no heap.
+//
+//   SLOG_FIELDS(SLOG_INFO, "login", SLOG_FIELD_STRING("user", name),
+//               SLOG_FIELD_OBJECT("geo", SLOG_FIELD_FLOAT("lat", lat)));
+//
+// Lists carry a dummy first element so that empty ones stay valid C.
+#define SLOG_FIELD_LIST(...)                                                   \
+	((const struct slog_field[]){{(enum slog_type)0, NULL, {NULL}},       \
+				     __VA_ARGS__} +                            \
+	 1)
+#define SLOG_FIELD_COUNT(...)                                                  \
+	(sizeof((const struct slog_field[]){{(enum slog_type)0, NULL, {NULL}}, \
+					    __VA_ARGS__}) /                    \
+		 sizeof(struct slog_field) -                                   \
+	 1)
+
+#define SLOG_FIELD_BOOL(K, V)                                                  \
+	{SLOG_TYPE_BOOL, K, {.boolean = (bool)(V)}}
+#define SLOG_FIELD_FLOAT(K, V)                                                 \
+	{SLOG_TYPE_FLOAT, K, {.number = (double)(V)}}
+#define SLOG_FIELD_STRING(K, V) {SLOG_TYPE_STRING, K, {.string = (V)}}
+#define SLOG_FIELD_STRING_N(K, V, N)                                           \
+	{SLOG_TYPE_STRING_N, K, {.text = {(V), (size_t)(N)}}}
+#define SLOG_FIELD_TRUSTED(K, V) {SLOG_TYPE_TRUSTED, K, {.string = (V)}}
+#define SLOG_FIELD_RAW(K, V, N) {SLOG_TYPE_RAW, K, {.text = {(V), (size_t)(N)}}}
+#define SLOG_FIELD_INT(K, V)                                                   \
+	{SLOG_TYPE_INT, K, {.integer = (long long)(V)}}
+#define SLOG_FIELD_ARRAY(K, ...)                                               \
+	{SLOG_TYPE_ARRAY,                                                      \
+	 K,                                                                    \
+	 {.list = {SLOG_FIELD_LIST(__VA_ARGS__),                               \
+		   SLOG_FIELD_COUNT(__VA_ARGS__)}}}
+#define SLOG_FIELD_OBJECT(K, ...)                                              \
+	{SLOG_TYPE_OBJECT,                                                     \
+	 K,                                                                    \
+	 {.list = {SLOG_FIELD_LIST(__VA_ARGS__),                               \
+		   SLOG_FIELD_COUNT(__VA_ARGS__)}}}
+
+#define SLOG_FIELDS(LEVEL, MSG, ...)                                           \
+	do {                                                                   \
+		if ((LEVEL) <= SLOG_MIN_LEVEL) {                               \
+			static struct slog_callsite slog_callsite =            \
+				SLOG_CALLSITE_INIT(LEVEL);                     \
+			if (slog_callsite_enabled(&slog_callsite)) {           \
+				slog_log_fields(                               \
+					&slog_callsite, MSG,                   \
+					SLOG_FIELD_LIST(__VA_ARGS__),          \
+					SLOG_FIELD_COUNT(__VA_ARGS__));        \
+			}                                                      \
 		}                                                              \
 	} while (0)
 
@@ -0,0 +1,405 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef SLOG_HPP
+#define SLOG_HPP
+
+#include "slog.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+// C++17 front end:
+//
+//     slog::info("login", slog::kv("user", name), slog::kv("id", 42));
+//
+// Value types are deduced at compile time, keys are escaped by constexpr
+// constructors, and JSON records are written straight into slog_buffer:
+// no va_arg, no node list, no allocation per field. Other encodings and
+// binary records get the same fields through slog_log_fields.
+namespace slog {
+
+// A key and its JSON form `"key":`. The escaping runs at compile time for
+// a constexpr key, e.g. static constexpr slog::key user{"user"}, and is
+// folded by the optimizer for the literals given to kv.
+template <std::size_t N> struct key {
+	const char *name;
+	char json[6 * N + 2];
+	std::size_t len;
+
+	constexpr key(const char (&k)[N]) : name(k), json{}, len(0) {
+		constexpr char hex[] = "0123456789abcdef";
+		json[len++] = '"';
+		for (std::size_t i = 0; i + 1 < N; i++) {
+			const auto c = static_cast<unsigned char>(k[i]);
+			const char escape = slog_escape_table[c];
+			if (!escape) {
+				json[len++] = k[i];
+				continue;
+			}
+			json[len++] = '\\';
+			json[len++] = escape;
+			if (escape == 'u') {
+				json[len++] = '0';
+				json[len++] = '0';
+				json[len++] = hex[c >> 4];
+				json[len++] = hex[c & 0xf];
+			}
+		}
+		json[len++] = '"';
+		json[len++] = ':';
+	}
+};
+
+namespace detail {
+
+// Copied verbatim into JSON records.
+struct raw_text {
+	std::string_view json;
+};
+
+template <typename... Values> struct array {
+	std::tuple<Values...> values;
+	mutable slog_field items[sizeof...(Values) ? sizeof...(Values) : 1];
+};
+
+template <typename... Fields> struct object {
+	std::tuple<Fields...> fields;
+	mutable slog_field items[sizeof...(Fields) ? sizeof...(Fields) : 1];
+};
+
+template <typename T> struct is_nested : std::false_type {};
+template <typename... T> struct is_nested<array<T...>> : std::true_type {};
+template <typename... T> struct is_nested<object<T...>> : std::true_type {};
+
+template <typename T> inline constexpr bool unsupported = false;
+
+// Maps a value to the type it is written as.
+template <typename T> constexpr auto value(const T &v) {
+	using U = std::decay_t<T>;
+	if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, char> ||
+		      std::is_same_v<U, raw_text> || is_nested<U>::value) {
+		return v;
+	} else if constexpr (std::is_enum_v<U>) {
+		return value(static_cast<std::underlying_type_t<U>>(v));
+	} else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+		return static_cast<long long>(v);
+	} else if constexpr (std::is_integral_v<U>) {
+		return static_cast<unsigned long long>(v);
+	} else if constexpr (std::is_floating_point_v<U>) {
+		return static_cast<double>(v);
+	} else if constexpr (std::is_convertible_v<const T &, const char *>) {
+		const char *str = v;
+		assert(str);
+		return std::string_view(str);
+	} else if constexpr (std::is_convertible_v<const T &,
+						   std::string_view>) {
+		return std::string_view(v);
+	} else {
+		static_assert(unsupported<T>, "slog: unsupported value type");
+	}
+}
+
+template <typename T> using value_t = decltype(value(std::declval<T>()));
+
+} // namespace detail
+
+template <typename Key, typename Value> struct field {
+	Key k;
+	Value value;
+};
+
+template <std::size_t N, typename T>
+constexpr field<key<N>, detail::value_t<const T &>> kv(const char (&name)[N],
+						       const T &v) {
+	return {key<N>(name), detail::value(v)};
+}
+
+template <std::size_t N, typename T>
+constexpr field<const key<N> &, detail::value_t<const T &>>
+kv(const key<N> &k, const T &v) {
+	return {k, detail::value(v)};
+}
+
+// JSON serialized elsewhere, copied as it is.
+inline detail::raw_text raw(std::string_view json) { return {json}; }
+
+template <typename... Fields>
+detail::object<Fields...> object(const Fields &...fields) {
+	return {{fields...}, {}};
+}
+
+template <typename... Values>
+detail::array<detail::value_t<const Values &>...>
+array(const Values &...values) {
+	return {{detail::value(values)...}, {}};
+}
+
+namespace detail {
+
+// JSON output
+
+inline void write(bool v) { slog_write_bool(v); }
+inline void write(char v) { slog_write_escape_n(&v, 1); }
+inline void write(long long v) { slog_write_int(v); }
+inline void write(double v) { slog_write_double(v); }
+inline void write(std::string_view v) {
+	slog_write_escape_n(v.data(), v.size());
+}
+inline void write(const raw_text &v) {
+	slog_buffer_append(v.json.data(), v.json.size());
+}
+
+inline void write(unsigned long long v) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	char *p = slog_format_uint(v, end);
+	slog_buffer_append(p, static_cast<std::size_t>(end - p));
+}
+
+template <typename Key, typename Value>
+void write_field(const field<Key, Value> &f, bool comma) {
+	if (comma) {
+		slog_buffer_putc(',');
+	}
+	slog_buffer_append(f.k.json, f.k.len);
+	write(f.value);
+}
+
+template <typename... Values> void write(const array<Values...> &v) {
+	slog_buffer_putc('[');
+	std::apply(
+		[](const auto &...values) {
+			std::size_t i = 0;
+			((i++ ? slog_buffer_putc(',') : (void)0, write(values)),
+			 ...);
+		},
+		v.values);
+	slog_buffer_putc(']');
+}
+
+template <typename... Fields> void write(const object<Fields...> &v) {
+	slog_buffer_putc('{');
+	std::apply(
+		[](const auto &...fields) {
+			std::size_t i = 0;
+			(write_field(fields, i++ != 0), ...);
+		},
+		v.fields);
+	slog_buffer_putc('}');
+}
+
+// slog_field output, for the encoders and binary records
+
+inline void fill(slog_field &out, const bool &v) {
+	out.type = SLOG_TYPE_BOOL;
+	out.value.boolean = v;
+}
+
+inline void fill(slog_field &out, const char &v) {
+	out.type = SLOG_TYPE_STRING_N;
+	out.value.text.data = &v;
+	out.value.text.len = 1;
+}
+
+inline void fill(slog_field &out, const long long &v) {
+	out.type = SLOG_TYPE_INT;
+	out.value.integer = v;
+}
+
+// slog_field integers are signed: larger values lose precision as floats
+inline void fill(slog_field &out, const unsigned long long &v) {
+	if (v <= static_cast<unsigned long long>(LLONG_MAX)) {
+		out.type = SLOG_TYPE_INT;
+		out.value.integer = static_cast<long long>(v);
+	} else {
+		out.type = SLOG_TYPE_FLOAT;
+		out.value.number = static_cast<double>(v);
+	}
+}
+
+inline void fill(slog_field &out, const double &v) {
+	out.type = SLOG_TYPE_FLOAT;
+	out.value.number = v;
+}
+
+inline void fill(slog_field &out, const std::string_view &v) {
+	out.type = SLOG_TYPE_STRING_N;
+	out.value.text.data = v.data();
+	out.value.text.len = v.size();
+}
+
+inline void fill(slog_field &out, const raw_text &v) {
+	out.type = SLOG_TYPE_RAW;
+	out.value.text.data = v.json.data();
+	out.value.text.len = v.json.size();
+}
+
+template <typename Key, typename Value>
+void fill_field(slog_field &out, const field<Key, Value> &f) {
+	fill(out, f.value);
+	out.key = f.k.name;
+}
+
+template <typename... Values>
+void fill(slog_field &out, const array<Values...> &v) {
+	std::apply(
+		[&v](const auto &...values) {
+			std::size_t i = 0;
+			((v.items[i].key = nullptr, fill(v.items[i++], values)),
+			 ...);
+		},
+		v.values);
+	out.type = SLOG_TYPE_ARRAY;
+	out.value.list.items = v.items;
+	out.value.list.count = sizeof...(Values);
+}
+
+template <typename... Fields>
+void fill(slog_field &out, const object<Fields...> &v) {
+	std::apply(
+		[&v](const auto &...fields) {
+			std::size_t i = 0;
+			(fill_field(v.items[i++], fields), ...);
+		},
+		v.fields);
+	out.type = SLOG_TYPE_OBJECT;
+	out.value.list.items = v.items;
+	out.value.list.count = sizeof...(Fields);
+}
+
+// The message and where it was logged, filled in by default arguments,
+// which are evaluated in the caller: SLOG_MODULE is the caller's too.
+struct message {
+	const char *text;
+	const char *file;
+	const char *func;
+	int line;
+	const char *module;
+
+	message(const char *text, const char *file = __builtin_FILE(),
+		const char *func = __builtin_FUNCTION(),
+		int line = __builtin_LINE(), const char *module = SLOG_MODULE)
+		: text(text), file(file), func(func), line(line),
+		  module(module) {}
+};
+
+// Callsites by source location, created on first use and kept for the
+// life of the process like the static ones of the C macros. Lookups only
+// read; inserts take the lock.
+struct site_entry {
+	slog_callsite site;
+	site_entry *next;
+};
+
+inline constexpr std::size_t site_buckets = 1024;
+inline std::atomic<site_entry *> sites[site_buckets];
+inline std::mutex sites_lock;
+
+inline site_entry *find_site(site_entry *e, enum slog_level level,
+			     const message &msg) {
+	for (; e; e = e->next) {
+		if (e->site.line == msg.line && e->site.level == level &&
+		    e->site.file == msg.file && e->site.func == msg.func &&
+		    e->site.module == msg.module) {
+			return e;
+		}
+	}
+	return nullptr;
+}
+
+inline slog_callsite *callsite(enum slog_level level, const message &msg) {
+	const std::uint64_t h =
+		(reinterpret_cast<std::uintptr_t>(msg.file) ^
+		 static_cast<std::uint64_t>(msg.line) << 3 ^ level) *
+		0x9e3779b97f4a7c15ull;
+	std::atomic<site_entry *> &bucket = sites[h >> 54];
+	site_entry *e =
+		find_site(bucket.load(std::memory_order_acquire), level, msg);
+	if (e) {
+		return &e->site;
+	}
+
+	std::lock_guard<std::mutex> guard(sites_lock);
+	site_entry *head = bucket.load(std::memory_order_relaxed);
+	if ((e = find_site(head, level, msg))) {
+		return &e->site;
+	}
+	e = static_cast<site_entry *>(calloc(1, sizeof(*e)));
+	if (!e) {
+		return nullptr;
+	}
+	e->site.file = msg.file;
+	e->site.func = msg.func;
+	e->site.line = msg.line;
+	e->site.level = level;
+	e->site.module = msg.module;
+	e->next = head;
+	bucket.store(e, std::memory_order_release);
+	return &e->site;
+}
+
+template <typename... Fields>
+void log(slog_callsite *site, const char *msg, const Fields &...fields) {
+	struct timespec now;
+	slog_pass pass;
+	if (slog_json_begin(site, msg, &now, &pass)) {
+		(write_field(fields, true), ...);
+		slog_json_end(site, &now, &pass);
+		return;
+	}
+	slog_field items[sizeof...(Fields) ? sizeof...(Fields) : 1];
+	std::size_t i = 0;
+	(fill_field(items[i++], fields), ...);
+	slog_log_fields(site, msg, items, sizeof...(Fields));
+}
+
+} // namespace detail
+
+// Levels above SLOG_MIN_LEVEL compile to nothing. Records of a level that
+// neither the process level nor any override lets through are rejected
+// before the callsite lookup.
+template <enum slog_level Level, typename... Fields>
+void log(detail::message msg, [[maybe_unused]] const Fields &...fields) {
+	if constexpr (Level <= SLOG_MIN_LEVEL) {
+		if (!slog_level_possible(Level)) {
+			return;
+		}
+		slog_callsite *site = detail::callsite(Level, msg);
+		if (site && slog_callsite_enabled(site)) {
+			detail::log(site, msg.text, fields...);
+		}
+	}
+}
+
+template <typename... Fields>
+void error(detail::message msg, const Fields &...fields) {
+	log<SLOG_ERROR>(msg, fields...);
+}
+
+template <typename... Fields>
+void warn(detail::message msg, const Fields &...fields) {
+	log<SLOG_WARN>(msg, fields...);
+}
+
+template <typename... Fields>
+void info(detail::message msg, const Fields &...fields) {
+	log<SLOG_INFO>(msg, fields...);
+}
+
+template <typename... Fields>
+void debug(detail::message msg, const Fields &...fields) {
+	log<SLOG_DEBUG>(msg, fields...);
+}
+
+} // namespace slog
+
+#endif // SLOG_HPP
@@ -0,0 +1,473 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef SLOG_COMPRESS_H
+#define SLOG_COMPRESS_H
+
+#include "slog.h"
+
+#include <fcntl.h>
+#include <zlib.h>
+#ifdef SLOG_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Compressed file sink. Producers copy records into a pending buffer; a
+// background thread compresses it into the current frame and writes the
+// output. Every frame is a complete gzip member or zstd frame, closed after
+// frame_bytes of input or frame_ms after its first record, so the file is
+// a plain concatenation that zcat and zstdcat read, a reader can start at
+// any frame, and a crash loses at most the frame being written.
+enum slog_codec {
+	SLOG_CODEC_GZIP = 0,
+	SLOG_CODEC_ZSTD, // needs SLOG_HAVE_ZSTD, set by meson when found
+};
+
+struct slog_compress_config {
+	const char *path; // appended to, frames from earlier runs stay valid
+	enum slog_codec codec;
+	int level;           // codec level, 0 = codec default
+	size_t frame_bytes;  // uncompressed bytes per frame, default 1 MiB
+	unsigned frame_ms;   // oldest record age that ends a frame, default 1s
+	size_t buffer_bytes; // pending records, default 256 KiB
+};
+
+struct slog_compress {
+	pthread_mutex_t lock;
+	pthread_cond_t ready; // wakes the compressor
+	pthread_cond_t space; // wakes producers and flush callers
+
+	char *pending;
+	size_t pending_len;
+	size_t pending_size;
+	struct timespec pending_since;
+	size_t *ends; // offset after each pending record, where frames may end
+	size_t ends_count;
+	size_t ends_size;
+	char *spare;
+	size_t spare_size;
+	size_t *spare_ends;
+	size_t spare_ends_size;
+
+	unsigned long long flush_requested;
+	unsigned long long flush_done;
+	bool stopping;
+	pthread_t thread;
+
+	// owned by the compressor thread
+	struct slog_compress_config config;
+	int fd;
+	unsigned char *out;
+	size_t out_size;
+	size_t frame_in;
+	struct timespec frame_started;
+	unsigned long long frames;
+	z_stream zlib;
+	bool zlib_ready;
+#ifdef SLOG_HAVE_ZSTD
+	ZSTD_CCtx *zstd;
+#endif
+};
+
+static long long slog_compress_elapsed_ms(const struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)(now.tv_sec - since->tv_sec) * 1000 +
+	       (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void slog_compress_output(struct slog_compress *c, size_t len) {
+	const unsigned char *p = c->out;
+	while (len && c->fd >= 0) {
+		const ssize_t n = write(c->fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			fprintf(stderr, "Compressed log write failed\n");
+			return;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+}
+
+static bool slog_compress_gzip(struct slog_compress *c, const char *in,
+			       size_t len, bool finish) {
+	z_stream *z = &c->zlib;
+	z->next_in = (Bytef *)(uintptr_t)in;
+	z->avail_in = (uInt)len;
+	for (;;) {
+		z->next_out = c->out;
+		z->avail_out = (uInt)c->out_size;
+		const int ret = deflate(z, finish ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR) {
+			return false;
+		}
+		slog_compress_output(c, c->out_size - z->avail_out);
+		if (finish ? ret == Z_STREAM_END
+			   : !z->avail_in && z->avail_out) {
+			break;
+		}
+	}
+	return !finish || deflateReset(z) == Z_OK;
+}
+
+#ifdef SLOG_HAVE_ZSTD
+static bool slog_compress_zstd(struct slog_compress *c, const char *in,
+			       size_t len, bool finish) {
+	ZSTD_inBuffer input = {in, len, 0};
+	for (;;) {
+		ZSTD_outBuffer output = {c->out, c->out_size, 0};
+		const size_t left = ZSTD_compressStream2(
+			c->zstd, &output, &input,
+			finish ? ZSTD_e_end : ZSTD_e_continue);
+		if (ZSTD_isError(left)) {
+			return false;
+		}
+		slog_compress_output(c, output.pos);
+		if (finish ? !left : input.pos == input.size) {
+			return true;
+		}
+	}
+}
+#endif
+
+// Feeds len bytes into the current frame, then ends it if finish is set.
+static void slog_compress_frame(struct slog_compress *c, const char *in,
+				size_t len, bool finish) {
+	bool ok = false;
+	switch (c->config.codec) {
+	case SLOG_CODEC_GZIP:
+		ok = slog_compress_gzip(c, in, len, finish);
+		break;
+	case SLOG_CODEC_ZSTD:
+#ifdef SLOG_HAVE_ZSTD
+		ok = slog_compress_zstd(c, in, len, finish);
+#endif
+		break;
+	}
+	if (!ok) {
+		fprintf(stderr, "Log compression failed\n");
+	}
+	if (finish) {
+		c->frame_in = 0;
+		c->frames++;
+	} else {
+		c->frame_in += len;
+	}
+}
+
+static void *slog_compress_main(void *arg) {
+	struct slog_compress *c = (struct slog_compress *)arg;
+	const long long frame_ms = c->config.frame_ms;
+
+	pthread_mutex_lock(&c->lock);
+	for (;;) {
+		const bool flush = c->flush_requested != c->flush_done;
+		const struct timespec *oldest =
+			c->frame_in ? &c->frame_started
+			: c->pending_len ? &c->pending_since
+					 : NULL;
+		const bool due =
+			oldest && slog_compress_elapsed_ms(oldest) >= frame_ms;
+		if (!flush && !c->stopping && !due &&
+		    c->pending_len < c->pending_size / 2) {
+			if (!oldest) {
+				pthread_cond_wait(&c->ready, &c->lock);
+				continue;
+			}
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			const long long wait_ms =
+				frame_ms - slog_compress_elapsed_ms(oldest);
+			until.tv_sec += wait_ms / 1000;
+			until.tv_nsec += (wait_ms % 1000) * 1000000;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&c->ready, &c->lock, &until);
+			continue;
+		}
+
+		// swap buffers so producers keep going during compression
+		const unsigned long long request = c->flush_requested;
+		const bool stopping = c->stopping;
+		char *data = c->pending;
+		const size_t len = c->pending_len;
+		const size_t size = c->pending_size;
+		const struct timespec since = c->pending_since;
+		size_t *ends = c->ends;
+		const size_t ends_count = c->ends_count;
+		const size_t ends_size = c->ends_size;
+		c->pending = c->spare;
+		c->pending_size = c->spare_size;
+		c->pending_len = 0;
+		c->spare = data;
+		c->spare_size = size;
+		c->ends = c->spare_ends;
+		c->ends_size = c->spare_ends_size;
+		c->ends_count = 0;
+		c->spare_ends = ends;
+		c->spare_ends_size = ends_size;
+		pthread_mutex_unlock(&c->lock);
+
+		// frames end on a record boundary once frame_bytes is reached
+		size_t done = 0;
+		size_t next = 0; // first record ending after done
+		while (done < len) {
+			if (!c->frame_in) {
+				c->frame_started = since;
+			}
+			const size_t room = c->config.frame_bytes > c->frame_in
+						    ? c->config.frame_bytes -
+							      c->frame_in
+						    : 0;
+			size_t cut = len - done <= room ? len : done;
+			while (cut < len && next < ends_count &&
+			       ends[next] - done <= room) {
+				cut = ends[next++];
+			}
+			if (cut == done && !c->frame_in) {
+				// a record larger than a whole frame
+				cut = next < ends_count ? ends[next++] : len;
+			}
+			if (cut > done) {
+				slog_compress_frame(c, data + done, cut - done,
+						    false);
+				done = cut;
+			}
+			if (done < len ||
+			    c->frame_in >= c->config.frame_bytes) {
+				slog_compress_frame(c, NULL, 0, true);
+			}
+		}
+		if (c->frame_in &&
+		    (flush || stopping ||
+		     slog_compress_elapsed_ms(&c->frame_started) >= frame_ms)) {
+			slog_compress_frame(c, NULL, 0, true);
+		}
+
+		pthread_mutex_lock(&c->lock);
+		c->flush_done = request;
+		pthread_cond_broadcast(&c->space);
+		if (stopping && !c->pending_len) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+
+// Crash hook: the open frame cannot be ended safely, but the records not
+// compressed yet go to the crash fd as they are.
+static void slog_compress_crash(int fd, void *arg) {
+	const struct slog_compress *c = (const struct slog_compress *)arg;
+	if (fd >= 0) {
+		slog_crash_write(fd, c->pending, c->pending_len);
+	}
+}
+
+void slog_compress_close(struct slog_compress *c);
+
+struct slog_compress *
+slog_compress_open(const struct slog_compress_config *config) {
+	assert(config && config->path);
+#ifndef SLOG_HAVE_ZSTD
+	if (config->codec == SLOG_CODEC_ZSTD) {
+		fprintf(stderr, "zstd support was not built in\n");
+		return NULL;
+	}
+#endif
+	struct slog_compress *c =
+		(struct slog_compress *)calloc(1, sizeof(*c));
+	if (!c) {
+		return NULL;
+	}
+	c->config = *config;
+	if (!c->config.frame_bytes) {
+		c->config.frame_bytes = 1024 * 1024;
+	}
+	if (!c->config.frame_ms) {
+		c->config.frame_ms = 1000;
+	}
+	if (!c->config.buffer_bytes) {
+		c->config.buffer_bytes = 256 * 1024;
+	}
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->ready, NULL);
+	pthread_cond_init(&c->space, NULL);
+	c->stopping = true; // no thread to join until it is started
+	c->pending_size = c->spare_size = c->config.buffer_bytes;
+	c->pending = (char *)malloc(c->pending_size);
+	c->spare = (char *)malloc(c->spare_size);
+	c->out_size = 64 * 1024;
+	c->out = (unsigned char *)malloc(c->out_size);
+	c->fd = open(config->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+		     0644);
+	if (c->fd < 0) {
+		fprintf(stderr, "Compressed log open failed: %s\n",
+			config->path);
+	}
+
+	bool ok = c->pending && c->spare && c->out && c->fd >= 0;
+	if (ok && config->codec == SLOG_CODEC_GZIP) {
+		// windowBits 15 + 16 writes gzip members instead of zlib
+		c->zlib_ready =
+			deflateInit2(&c->zlib,
+				     config->level ? config->level
+						   : Z_DEFAULT_COMPRESSION,
+				     Z_DEFLATED, 15 + 16, 8,
+				     Z_DEFAULT_STRATEGY) == Z_OK;
+		ok = c->zlib_ready;
+	}
+#ifdef SLOG_HAVE_ZSTD
+	if (ok && config->codec == SLOG_CODEC_ZSTD) {
+		c->zstd = ZSTD_createCCtx();
+		ok = c->zstd &&
+		     !ZSTD_isError(ZSTD_CCtx_setParameter(
+			     c->zstd, ZSTD_c_compressionLevel,
+			     config->level ? config->level
+					   : ZSTD_CLEVEL_DEFAULT)) &&
+		     !ZSTD_isError(ZSTD_CCtx_setParameter(
+			     c->zstd, ZSTD_c_checksumFlag, 1));
+	}
+#endif
+	if (ok) {
+		c->stopping = false;
+		if (pthread_create(&c->thread, NULL, slog_compress_main, c)) {
+			c->stopping = true;
+			ok = false;
+		}
+	}
+	if (!ok) {
+		slog_compress_close(c);
+		return NULL;
+	}
+	SLOG_CRASH_HOOK(slog_compress_crash, c);
+	return c;
+}
+
+// Appends record, and a newline for text ones, to the pending buffer.
+// Producers only wait when the compressor has fallen a whole buffer behind.
+static void slog_compress_put(struct slog_compress *c, const char *record,
+			      size_t len, bool line) {
+	pthread_mutex_lock(&c->lock);
+	while (c->pending_len && c->pending_len + len + 1 > c->pending_size) {
+		pthread_cond_signal(&c->ready);
+		pthread_cond_wait(&c->space, &c->lock);
+	}
+	if (len + 1 > c->pending_size) {
+		char *bigger = (char *)realloc(c->pending, len + 1);
+		if (!bigger) {
+			pthread_mutex_unlock(&c->lock);
+			return;
+		}
+		c->pending = bigger;
+		c->pending_size = len + 1;
+	}
+	if (!c->pending_len) {
+		clock_gettime(CLOCK_MONOTONIC, &c->pending_since);
+		pthread_cond_signal(&c->ready);
+	}
+	memcpy(c->pending + c->pending_len, record, len);
+	c->pending_len += len;
+	if (line) {
+		c->pending[c->pending_len++] = '\n';
+	}
+	// without room for the boundary the frame ends at an earlier one
+	if (c->ends_count == c->ends_size) {
+		const size_t n = c->ends_size ? c->ends_size * 2 : 256;
+		size_t *grown = (size_t *)realloc(c->ends, n * sizeof(*grown));
+		if (grown) {
+			c->ends = grown;
+			c->ends_size = n;
+		}
+	}
+	if (c->ends_count < c->ends_size) {
+		c->ends[c->ends_count++] = c->pending_len;
+	}
+	if (c->pending_len >= c->pending_size / 2) {
+		pthread_cond_signal(&c->ready);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+// Appends record and a newline.
+void slog_compress_write(struct slog_compress *c, const char *record,
+			 size_t len) {
+	slog_compress_put(c, record, len, true);
+}
+
+// Ends the current frame and blocks until it is written.
+void slog_compress_flush(struct slog_compress *c) {
+	pthread_mutex_lock(&c->lock);
+	const unsigned long long target = ++c->flush_requested;
+	pthread_cond_signal(&c->ready);
+	while (c->flush_done < target) {
+		pthread_cond_wait(&c->space, &c->lock);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+void slog_compress_close(struct slog_compress *c) {
+	if (!c) {
+		return;
+	}
+	SLOG_CRASH_UNHOOK(slog_compress_crash, c);
+	pthread_mutex_lock(&c->lock);
+	const bool running = !c->stopping;
+	c->stopping = true;
+	pthread_cond_signal(&c->ready);
+	pthread_mutex_unlock(&c->lock);
+	if (running) {
+		pthread_join(c->thread, NULL);
+	}
+
+	if (c->zlib_ready) {
+		deflateEnd(&c->zlib);
+	}
+#ifdef SLOG_HAVE_ZSTD
+	ZSTD_freeCCtx(c->zstd);
+#endif
+	if (c->fd >= 0) {
+		close(c->fd);
+	}
+	free(c->pending);
+	free(c->spare);
+	free(c->ends);
+	free(c->spare_ends);
+	free(c->out);
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->ready);
+	pthread_cond_destroy(&c->space);
+	free(c);
+}
+
+// A sink writing to the slog_compress given as its arg, see SLOG_SINK_ADD.
+void slog_compress_sink(const struct slog_record *record, void *arg) {
+	slog_compress_put((struct slog_compress *)arg, record->data,
+			  record->len, !slog_encoding_binary(record->encoding));
+}
+
+static struct slog_compress *slog_compress_default = NULL;
+
+static void slog_compress_writer(const struct slog_record *record) {
+	slog_compress_put(
+		__atomic_load_n(&slog_compress_default, __ATOMIC_ACQUIRE),
+		record->data, record->len,
+		!slog_encoding_binary(record->encoding));
+}
+
+// Sends every record to c through slog_compress_writer.
+void SLOG_SET_COMPRESS(struct slog_compress *c) {
+	assert(c);
+	__atomic_store_n(&slog_compress_default, c, __ATOMIC_RELEASE);
+	SLOG_SET_WRITER(slog_compress_writer, false);
+}
+
+#endif // SLOG_COMPRESS_H
@@ -0,0 +1,391 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef SLOG_FILE_H
+#define SLOG_FILE_H
+
+#include "slog.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Buffered file sink. Records are copied into a ring of page-aligned
+// buffers; a writer thread sends every full buffer with one writev call, and
+// also flushes a partly filled one once its oldest record is latency_ms old.
+// Rotation happens on the writer thread, so producers only ever wait when
+// every buffer is full.
+struct slog_file_config {
+	const char *path;
+	size_t buffer_size;      // bytes per buffer, default 256 KiB
+	unsigned buffers;        // default 4
+	unsigned latency_ms;     // default 100
+	size_t max_bytes;        // rotate before exceeding this, 0 = never
+	unsigned rotate_seconds; // rotate files older than this, 0 = never
+};
+
+struct slog_file_buffer {
+	char *data;
+	size_t len;
+};
+
+struct slog_file {
+	pthread_mutex_t lock;
+	pthread_cond_t ready; // wakes the writer
+	pthread_cond_t space; // wakes producers and flush callers
+
+	struct slog_file_buffer *buffers;
+	unsigned count;
+	unsigned head;   // oldest sealed buffer
+	unsigned sealed; // buffers waiting for the writer
+	struct timespec first_pending;
+
+	unsigned long long flush_requested;
+	unsigned long long flush_done;
+	bool stopping;
+	pthread_t thread;
+
+	struct slog_file_config config;
+	char *path;
+	int fd;
+	size_t file_size;
+	time_t opened;
+	unsigned rotations;
+	bool rotate_failing; // reported, until a rotation succeeds
+};
+
+static inline struct slog_file_buffer *slog_file_active(struct slog_file *f) {
+	return &f->buffers[(f->head + f->sealed) % f->count];
+}
+
+// Replaces the current fd, which stays in use when the open fails.
+static int slog_file_open_fd(struct slog_file *f) {
+	const int fd =
+		open(f->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	if (f->fd >= 0) {
+		close(f->fd);
+	}
+	f->fd = fd;
+	struct stat st;
+	f->file_size = fstat(f->fd, &st) == 0 ? (size_t)st.st_size : 0;
+	f->opened = time(NULL);
+	return 0;
+}
+
+// Renames the current file to path.YYYYmmdd-HHMMSS[.N] and starts a new one.
+// On failure records keep going to the current file, the next attempt
+// waits for another max_bytes or rotate_seconds, and only the first of a
+// run of failures is reported.
+static void slog_file_rotate(struct slog_file *f) {
+	char stamp[32];
+	struct tm tm;
+	const time_t now = time(NULL);
+	gmtime_r(&now, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+	const size_t size = strlen(f->path) + sizeof(stamp) + 16;
+	char *target = (char *)malloc(size);
+	if (!target) {
+		return;
+	}
+	snprintf(target, size, "%s.%s", f->path, stamp);
+	for (unsigned n = 1; access(target, F_OK) == 0; n++) {
+		snprintf(target, size, "%s.%s.%u", f->path, stamp, n);
+	}
+
+	// ENOENT: moved away already, by an attempt whose open failed
+	const bool moved = rename(f->path, target) == 0 || errno == ENOENT;
+	if (moved && slog_file_open_fd(f) == 0) {
+		f->rotations++;
+		f->rotate_failing = false;
+	} else {
+		if (!f->rotate_failing) {
+			fprintf(stderr, "Log file rotation failed: %s\n",
+				target);
+		}
+		f->rotate_failing = true;
+		f->file_size = 0;
+		f->opened = time(NULL);
+	}
+	free(target);
+}
+
+static void slog_file_write_all(struct slog_file *f, struct iovec *iov,
+				int iovcnt) {
+	while (iovcnt > 0 && f->fd >= 0) {
+		const ssize_t n = writev(f->fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			fprintf(stderr, "Log file write failed\n");
+			return;
+		}
+		f->file_size += (size_t)n;
+		size_t done = (size_t)n;
+		while (iovcnt > 0 && done >= iov->iov_len) {
+			done -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+}
+
+static long long slog_file_elapsed_ms(const struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)(now.tv_sec - since->tv_sec) * 1000 +
+	       (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void *slog_file_main(void *arg) {
+	struct slog_file *f = (struct slog_file *)arg;
+	struct iovec *iov = (struct iovec *)calloc(f->count, sizeof(*iov));
+
+	pthread_mutex_lock(&f->lock);
+	for (;;) {
+		struct slog_file_buffer *active = slog_file_active(f);
+		const bool flush = f->flush_requested != f->flush_done;
+		if (!f->sealed && !flush && !f->stopping) {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			long long wait_ms = f->config.latency_ms;
+			if (active->len) {
+				wait_ms -= slog_file_elapsed_ms(&f->first_pending);
+			}
+			if (wait_ms > 0) {
+				until.tv_sec += wait_ms / 1000;
+				until.tv_nsec += (wait_ms % 1000) * 1000000;
+				if (until.tv_nsec >= 1000000000L) {
+					until.tv_sec++;
+					until.tv_nsec -= 1000000000L;
+				}
+				pthread_cond_timedwait(&f->ready, &f->lock,
+						       &until);
+				continue;
+			}
+		}
+
+		// seal the partly filled buffer when it is due or requested;
+		// the buffers taken below then hold everything written before
+		// the request, whatever producers add while they are written
+		const unsigned long long request = f->flush_requested;
+		active = slog_file_active(f);
+		bool covered = !active->len;
+		if (active->len && f->sealed < f->count - 1 &&
+		    (flush || f->stopping ||
+		     slog_file_elapsed_ms(&f->first_pending) >=
+			     f->config.latency_ms)) {
+			f->sealed++;
+			covered = true;
+		}
+
+		const unsigned n = f->sealed;
+		size_t total = 0;
+		for (unsigned i = 0; i < n; i++) {
+			struct slog_file_buffer *b =
+				&f->buffers[(f->head + i) % f->count];
+			iov[i].iov_base = b->data;
+			iov[i].iov_len = b->len;
+			total += b->len;
+		}
+		pthread_mutex_unlock(&f->lock);
+
+		if (total) {
+			if ((f->config.max_bytes && f->file_size &&
+			     f->file_size + total > f->config.max_bytes) ||
+			    (f->config.rotate_seconds &&
+			     time(NULL) - f->opened >=
+				     (time_t)f->config.rotate_seconds)) {
+				slog_file_rotate(f);
+			}
+			if (iov) {
+				slog_file_write_all(f, iov, (int)n);
+			}
+		}
+
+		pthread_mutex_lock(&f->lock);
+		for (unsigned i = 0; i < n; i++) {
+			f->buffers[(f->head + i) % f->count].len = 0;
+		}
+		f->head = (f->head + n) % f->count;
+		f->sealed -= n;
+		if (covered) {
+			f->flush_done = request;
+		}
+		if (f->stopping && !f->sealed && !slog_file_active(f)->len) {
+			break;
+		}
+		pthread_cond_broadcast(&f->space);
+	}
+	pthread_cond_broadcast(&f->space);
+	pthread_mutex_unlock(&f->lock);
+	free(iov);
+	return NULL;
+}
+
+// Crash hook: sends the buffers the writer thread has not finished with
+// straight to the file, so records it was writing may appear twice.
+static void slog_file_crash(int fd, void *arg) {
+	(void)fd;
+	const struct slog_file *f = (const struct slog_file *)arg;
+	for (unsigned i = 0; i <= f->sealed && i < f->count; i++) {
+		const struct slog_file_buffer *b =
+			&f->buffers[(f->head + i) % f->count];
+		slog_crash_write(f->fd, b->data, b->len);
+	}
+}
+
+void slog_file_close(struct slog_file *f);
+
+struct slog_file *slog_file_open(const struct slog_file_config *config) {
+	assert(config && config->path);
+	struct slog_file *f = (struct slog_file *)calloc(1, sizeof(*f));
+	if (!f) {
+		return NULL;
+	}
+	f->config = *config;
+	if (!f->config.buffer_size) {
+		f->config.buffer_size = 256 * 1024;
+	}
+	if (!f->config.latency_ms) {
+		f->config.latency_ms = 100;
+	}
+	f->count = config->buffers >= 2 ? config->buffers : 4;
+	f->path = strdup(config->path);
+	f->buffers = (struct slog_file_buffer *)calloc(f->count,
+						       sizeof(*f->buffers));
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->ready, NULL);
+	pthread_cond_init(&f->space, NULL);
+	f->fd = -1;
+
+	bool ok = f->path && f->buffers;
+	for (unsigned i = 0; ok && i < f->count; i++) {
+		ok = posix_memalign((void **)&f->buffers[i].data, 4096,
+				    f->config.buffer_size) == 0;
+	}
+	if (ok && slog_file_open_fd(f) != 0) {
+		fprintf(stderr, "Log file open failed: %s\n", f->path);
+		ok = false;
+	}
+	if (!ok || pthread_create(&f->thread, NULL, slog_file_main, f) != 0) {
+		f->stopping = true; // no thread to join
+		slog_file_close(f);
+		return NULL;
+	}
+	SLOG_CRASH_HOOK(slog_file_crash, f);
+	return f;
+}
+
+// Appends record, and a newline for text ones; records larger than a
+// buffer span several.
+static void slog_file_put(struct slog_file *f, const char *record, size_t len,
+			  bool line) {
+	const char newline = '\n';
+	pthread_mutex_lock(&f->lock);
+	for (int part = 0; part < 1 + line; part++) {
+		const char *p = part ? &newline : record;
+		size_t left = part ? 1 : len;
+		while (left) {
+			struct slog_file_buffer *active = slog_file_active(f);
+			if (active->len == f->config.buffer_size) {
+				if (f->sealed == f->count - 1) {
+					pthread_cond_signal(&f->ready);
+					pthread_cond_wait(&f->space, &f->lock);
+					continue;
+				}
+				f->sealed++;
+				pthread_cond_signal(&f->ready);
+				continue;
+			}
+			if (!active->len) {
+				clock_gettime(CLOCK_MONOTONIC, &f->first_pending);
+			}
+			size_t n = f->config.buffer_size - active->len;
+			n = n < left ? n : left;
+			memcpy(active->data + active->len, p, n);
+			active->len += n;
+			p += n;
+			left -= n;
+		}
+	}
+	pthread_mutex_unlock(&f->lock);
+}
+
+// Appends record and a newline.
+void slog_file_write(struct slog_file *f, const char *record, size_t len) {
+	slog_file_put(f, record, len, true);
+}
+
+// Blocks until every record written before the call is in the file.
+void slog_file_flush(struct slog_file *f) {
+	pthread_mutex_lock(&f->lock);
+	const unsigned long long target = ++f->flush_requested;
+	pthread_cond_signal(&f->ready);
+	while (f->flush_done < target) {
+		pthread_cond_wait(&f->space, &f->lock);
+	}
+	pthread_mutex_unlock(&f->lock);
+}
+
+void slog_file_close(struct slog_file *f) {
+	if (!f) {
+		return;
+	}
+	SLOG_CRASH_UNHOOK(slog_file_crash, f);
+	pthread_mutex_lock(&f->lock);
+	const bool running = !f->stopping;
+	f->stopping = true;
+	pthread_cond_signal(&f->ready);
+	pthread_mutex_unlock(&f->lock);
+	if (running) {
+		pthread_join(f->thread, NULL);
+	}
+
+	if (f->fd >= 0) {
+		close(f->fd);
+	}
+	for (unsigned i = 0; f->buffers && i < f->count; i++) {
+		free(f->buffers[i].data);
+	}
+	free(f->buffers);
+	free(f->path);
+	pthread_mutex_destroy(&f->lock);
+	pthread_cond_destroy(&f->ready);
+	pthread_cond_destroy(&f->space);
+	free(f);
+}
+
+// A sink writing to the slog_file given as its arg, see SLOG_SINK_ADD.
+void slog_file_sink(const struct slog_record *record, void *arg) {
+	slog_file_put((struct slog_file *)arg, record->data, record->len,
+		      !slog_encoding_binary(record->encoding));
+}
+
+static struct slog_file *slog_file_default = NULL;
+
+static void slog_file_writer(const struct slog_record *record) {
+	slog_file_put(__atomic_load_n(&slog_file_default, __ATOMIC_ACQUIRE),
+		      record->data, record->len,
+		      !slog_encoding_binary(record->encoding));
+}
+
+// Sends every record to f through slog_file_writer.
+void SLOG_SET_FILE(struct slog_file *f) {
+	assert(f);
+	__atomic_store_n(&slog_file_default, f, __ATOMIC_RELEASE);
+	SLOG_SET_WRITER(slog_file_writer, false);
+}
+
+#endif // SLOG_FILE_H
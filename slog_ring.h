@@ -0,0 +1,236 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef SLOG_RING_H
+#define SLOG_RING_H
+
+#include "slog.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Crash-safe ring sink. Records are copied into a shared file mapping, so
+// the page cache still holds the last capacity bytes after the process is
+// killed; no system call is made per record. Files use native byte order
+// and are meant to be read on the machine that wrote them.
+//
+// Layout: a one page header, then the ring. Each entry is
+//   u64 position | u32 length | u32 magic | record | padding | u64 ~position
+// where position is the entry's absolute offset in the stream. The trailing
+// word is written last, so half-written entries are ignored by the reader.
+
+#define SLOG_RING_MAGIC "SLR1"
+#define SLOG_RING_HEADER 4096
+#define SLOG_RING_ENTRY_MAGIC 0x45524c53u // "SLRE"
+#define SLOG_RING_OVERHEAD 24
+
+struct slog_ring_header {
+	char magic[4];
+	uint32_t header_size;
+	uint64_t capacity;
+	uint64_t write; // end of the newest reserved entry
+};
+
+struct slog_ring {
+	struct slog_ring_header *header;
+	unsigned char *data;
+	uint64_t capacity;
+	size_t map_size;
+	unsigned long long dropped; // records larger than the ring
+};
+
+static inline uint64_t slog_ring_entry_size(size_t len) {
+	return ((uint64_t)len + SLOG_RING_OVERHEAD + 7) & ~(uint64_t)7;
+}
+
+// Maps path, creating or resizing it to hold capacity bytes of records. An
+// existing ring of the same capacity is continued rather than cleared.
+struct slog_ring *slog_ring_open(const char *path, size_t capacity) {
+	capacity = (capacity + 4095) & ~(size_t)4095;
+	if (capacity < 4096) {
+		capacity = 4096;
+	}
+
+	const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Ring file open failed: %s\n", path);
+		return NULL;
+	}
+	const size_t map_size = SLOG_RING_HEADER + capacity;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size != map_size) {
+		if (ftruncate(fd, 0) != 0 || ftruncate(fd, map_size) != 0) {
+			fprintf(stderr, "Ring file resize failed: %s\n", path);
+			close(fd);
+			return NULL;
+		}
+	}
+	void *map =
+		mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Ring file mmap failed: %s\n", path);
+		return NULL;
+	}
+
+	struct slog_ring *r = (struct slog_ring *)calloc(1, sizeof(*r));
+	if (!r) {
+		munmap(map, map_size);
+		return NULL;
+	}
+	r->header = (struct slog_ring_header *)map;
+	r->data = (unsigned char *)map + SLOG_RING_HEADER;
+	r->capacity = capacity;
+	r->map_size = map_size;
+
+	if (memcmp(r->header->magic, SLOG_RING_MAGIC, 4) != 0 ||
+	    r->header->header_size != SLOG_RING_HEADER ||
+	    r->header->capacity != capacity) {
+		memset(map, 0, map_size);
+		r->header->header_size = SLOG_RING_HEADER;
+		r->header->capacity = capacity;
+		memcpy(r->header->magic, SLOG_RING_MAGIC, 4);
+	}
+	return r;
+}
+
+// Copies one record into the ring. Entries never wrap: when one does not
+// fit before the end of the ring it starts again at offset zero.
+bool slog_ring_write(struct slog_ring *r, const char *record, size_t len) {
+	const uint64_t size = slog_ring_entry_size(len);
+	if (size > r->capacity) {
+		__atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	uint64_t write = __atomic_load_n(&r->header->write, __ATOMIC_RELAXED);
+	uint64_t pos;
+	do {
+		const uint64_t offset = write % r->capacity;
+		pos = offset + size > r->capacity
+			      ? write + (r->capacity - offset)
+			      : write;
+	} while (!__atomic_compare_exchange_n(&r->header->write, &write,
+					      pos + size, true,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+
+	unsigned char *p = r->data + pos % r->capacity;
+	const uint32_t len32 = (uint32_t)len;
+	const uint32_t magic = SLOG_RING_ENTRY_MAGIC;
+	memcpy(p, &pos, 8);
+	memcpy(p + 8, &len32, 4);
+	memcpy(p + 12, &magic, 4);
+	memcpy(p + 16, record, len);
+	memset(p + 16 + len, 0, size - SLOG_RING_OVERHEAD - len);
+	__atomic_store_n((uint64_t *)(void *)(p + size - 8), ~pos,
+			 __ATOMIC_RELEASE);
+	return true;
+}
+
+void slog_ring_close(struct slog_ring *r) {
+	if (!r) {
+		return;
+	}
+	munmap(r->header, r->map_size);
+	free(r);
+}
+
+typedef void (*slog_ring_visitor_t)(const char *record, size_t len,
+				    void *arg);
+
+struct slog_ring_entry {
+	uint64_t pos;
+	uint64_t offset;
+	uint32_t len;
+};
+
+static int slog_ring_entry_cmp(const void *a, const void *b) {
+	const uint64_t x = ((const struct slog_ring_entry *)a)->pos;
+	const uint64_t y = ((const struct slog_ring_entry *)b)->pos;
+	return x < y ? -1 : x > y;
+}
+
+// Calls visit for every complete record in a mapped ring file, oldest
+// first. Returns the number of records, or -1 when map is not a ring.
+long slog_ring_replay(const void *map, size_t map_size,
+		      slog_ring_visitor_t visit, void *arg) {
+	const struct slog_ring_header *header =
+		(const struct slog_ring_header *)map;
+	if (map_size < SLOG_RING_HEADER ||
+	    memcmp(header->magic, SLOG_RING_MAGIC, 4) != 0 ||
+	    header->header_size != SLOG_RING_HEADER ||
+	    header->capacity != map_size - SLOG_RING_HEADER) {
+		return -1;
+	}
+	const unsigned char *data = (const unsigned char *)map + SLOG_RING_HEADER;
+	const uint64_t capacity = header->capacity;
+	const uint64_t write = __atomic_load_n(&header->write, __ATOMIC_ACQUIRE);
+	const uint64_t oldest = write > capacity ? write - capacity : 0;
+
+	struct slog_ring_entry *entries = (struct slog_ring_entry *)malloc(
+		(capacity / SLOG_RING_OVERHEAD + 1) * sizeof(*entries));
+	if (!entries) {
+		return -1;
+	}
+	size_t count = 0;
+	uint64_t offset = 0;
+	while (offset + SLOG_RING_OVERHEAD <= capacity) {
+		const unsigned char *p = data + offset;
+		uint64_t pos, commit;
+		uint32_t len, magic;
+		memcpy(&pos, p, 8);
+		memcpy(&len, p + 8, 4);
+		memcpy(&magic, p + 12, 4);
+		const uint64_t size = slog_ring_entry_size(len);
+		if (magic != SLOG_RING_ENTRY_MAGIC || pos % capacity != offset ||
+		    pos < oldest || offset + size > capacity ||
+		    pos + size > write) {
+			offset += 8;
+			continue;
+		}
+		memcpy(&commit, p + size - 8, 8);
+		if (commit != ~pos) {
+			offset += 8;
+			continue;
+		}
+		entries[count].pos = pos;
+		entries[count].offset = offset;
+		entries[count].len = len;
+		count++;
+		offset += size;
+	}
+
+	qsort(entries, count, sizeof(*entries), slog_ring_entry_cmp);
+	for (size_t i = 0; i < count; i++) {
+		visit((const char *)data + entries[i].offset + 16,
+		      entries[i].len, arg);
+	}
+	free(entries);
+	return (long)count;
+}
+
+// A sink writing to the slog_ring given as its arg, see SLOG_SINK_ADD.
+void slog_ring_sink(const struct slog_record *record, void *arg) {
+	slog_ring_write((struct slog_ring *)arg, record->data, record->len);
+}
+
+static struct slog_ring *slog_ring_default = NULL;
+
+static void slog_ring_writer(const struct slog_record *record) {
+	slog_ring_write(__atomic_load_n(&slog_ring_default, __ATOMIC_ACQUIRE),
+			record->data, record->len);
+}
+
+// Sends every record to r through slog_ring_writer.
+void SLOG_SET_RING(struct slog_ring *r) {
+	assert(r);
+	__atomic_store_n(&slog_ring_default, r, __ATOMIC_RELEASE);
+	SLOG_SET_WRITER(slog_ring_writer, false);
+}
+
+#endif // SLOG_RING_H
@@ -0,0 +1,124 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 4
+#define RECORDS 1000
+
+static char *captured = NULL;
+static int handler_calls = 0;
+static int gate_closed = 0;
+
+// only ever called from the async writer thread
+static void capture_handler(const char *str) {
+	while (__atomic_load_n(&gate_closed, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+	handler_calls++;
+	free(captured);
+	captured = strdup(str);
+}
+
+static int suite_cleanup(void) {
+	SLOG_FREE();
+	free(captured);
+	captured = NULL;
+	handler_calls = 0;
+	return 0;
+}
+
+static void *log_worker(void *arg) {
+	(void)arg;
+	for (int i = 0; i < RECORDS; i++) {
+		SLOG(SLOG_INFO, "from worker", SLOG_INT("i", i));
+	}
+	SLOG_FREE();
+	return NULL;
+}
+
+void test_async_all_records_delivered(void) {
+	struct slog_async_config config = {
+		.capacity = 64,
+		.policy = SLOG_ASYNC_BLOCK,
+		.handler = capture_handler,
+	};
+	CU_ASSERT_TRUE_FATAL(SLOG_ASYNC_START(&config));
+	CU_ASSERT_FALSE(SLOG_ASYNC_START(&config));
+
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, log_worker, NULL);
+	}
+	for (int i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	SLOG_FLUSH();
+
+	struct slog_async_stats stats;
+	SLOG_ASYNC_STATS(&stats);
+	CU_ASSERT_EQUAL(handler_calls, THREADS * RECORDS);
+	CU_ASSERT_EQUAL(stats.enqueued, THREADS * RECORDS);
+	CU_ASSERT_EQUAL(stats.written, THREADS * RECORDS);
+	CU_ASSERT_EQUAL(stats.dropped_newest, 0);
+
+	SLOG_ASYNC_STOP();
+}
+
+static void run_with_full_queue(enum slog_async_policy policy) {
+	struct slog_async_config config = {
+		.capacity = 4,
+		.policy = policy,
+		.handler = capture_handler,
+	};
+	handler_calls = 0;
+	__atomic_store_n(&gate_closed, 1, __ATOMIC_RELEASE);
+	CU_ASSERT_TRUE_FATAL(SLOG_ASYNC_START(&config));
+
+	for (int i = 0; i < 100; i++) {
+		SLOG(SLOG_INFO, "burst", SLOG_INT("i", i));
+	}
+	__atomic_store_n(&gate_closed, 0, __ATOMIC_RELEASE);
+	SLOG_FLUSH();
+}
+
+void test_async_drop_newest(void) {
+	run_with_full_queue(SLOG_ASYNC_DROP_NEWEST);
+
+	struct slog_async_stats stats;
+	SLOG_ASYNC_STATS(&stats);
+	CU_ASSERT(stats.dropped_newest > 0);
+	CU_ASSERT_EQUAL(stats.written + stats.dropped_newest, 100);
+	CU_ASSERT_EQUAL((unsigned long long)handler_calls, stats.written);
+	// stopping is part of SLOG_FREE on the starting thread
+	SLOG_FREE();
+	CU_ASSERT_FALSE(slog_async_running());
+}
+
+void test_async_drop_oldest(void) {
+	run_with_full_queue(SLOG_ASYNC_DROP_OLDEST);
+
+	struct slog_async_stats stats;
+	SLOG_ASYNC_STATS(&stats);
+	CU_ASSERT(stats.dropped_oldest > 0);
+	CU_ASSERT_EQUAL(stats.enqueued, 100);
+	CU_ASSERT_EQUAL(stats.written + stats.dropped_oldest, 100);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"i\":99"));
+	SLOG_FREE();
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_async = CU_add_suite("async", NULL, suite_cleanup);
+	CU_add_test(suite_async, "all records delivered",
+		    test_async_all_records_delivered);
+	CU_add_test(suite_async, "drop newest", test_async_drop_newest);
+	CU_add_test(suite_async, "drop oldest", test_async_drop_oldest);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,153 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *captured = NULL;
+
+static void capture_handler(const char *str) {
+	free(captured);
+	captured = strdup(str);
+}
+
+static int suite_cleanup(void) {
+	SLOG_FREE();
+	free(captured);
+	captured = NULL;
+	return 0;
+}
+
+// the two modes read the clock at different moments
+static void strip_time(char *json) {
+	char *time = strstr(json, "\"time\":\"");
+	if (!time) {
+		return;
+	}
+	char *end = strchr(time + 8, '"');
+	memmove(time, end + 2, strlen(end + 2) + 1);
+}
+
+static void log_sample(int i) {
+	SLOG(SLOG_WARN, "sample \"quoted\"", SLOG_INT("i", i),
+	     SLOG_FLOAT("ratio", i / 3.0), SLOG_STRING("tab", "a\tb"),
+	     SLOG_STRING_N("slice", "a\"bc", 3), SLOG_RAW("raw", "[1,{}]", 6),
+	     SLOG_ARRAY("list", SLOG_INT(NULL, -i), SLOG_BOOL("dropped", true)),
+	     SLOG_OBJECT("obj", SLOG_OBJECT("inner", SLOG_STRING("k", "v"))));
+}
+
+void test_binary_decodes_to_json(void) {
+	const char *decoder = getenv("SLOG_DECODE");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoder);
+
+	char path[] = "/tmp/slog-binary-XXXXXX";
+	int fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+
+	SLOG_BINARY_START(fd);
+	for (int i = 0; i < 2000; i++) {
+		log_sample(i);
+	}
+	SLOG_BINARY_STOP();
+	close(fd);
+
+	char command[256];
+	snprintf(command, sizeof(command), "%s %s", decoder, path);
+	FILE *decoded = popen(command, "r");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+
+	SLOG_SET_HANDLER(capture_handler);
+	char line[1024];
+	int records = 0;
+	while (fgets(line, sizeof(line), decoded)) {
+		line[strcspn(line, "\n")] = '\0';
+		log_sample(records++);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+		strip_time(line);
+		strip_time(captured);
+		// same callsite, different line
+		char *json_line = strstr(captured, "\"line\":");
+		char *bin_line = strstr(line, "\"line\":");
+		CU_ASSERT_PTR_NOT_NULL_FATAL(json_line);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(bin_line);
+		CU_ASSERT_STRING_EQUAL(strchr(bin_line, ','),
+				       strchr(json_line, ','));
+	}
+	CU_ASSERT_EQUAL(pclose(decoded), 0);
+	CU_ASSERT_EQUAL(records, 2000);
+	unlink(path);
+}
+
+static void write_chunk(FILE *out, const unsigned char *payload,
+			size_t len) {
+	const unsigned char header[SLOG_BINARY_HEADER] = {
+		'S', 'L', 'B', '1', 1, 0, 0, 0, (unsigned char)len,
+		(unsigned char)(len >> 8)};
+	fwrite(header, 1, sizeof(header), out);
+	fwrite(payload, 1, len, out);
+}
+
+void test_binary_rejects_corrupt_chunks(void) {
+	const char *decoder = getenv("SLOG_DECODE");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoder);
+
+	char path[] = "/tmp/slog-binary-XXXXXX";
+	int fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	FILE *out = fdopen(fd, "wb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+
+	// a definition id that would wrap the table size
+	const unsigned char wrap[] = {'S',  0xff, 0xff, 0xff, 0xff, 0xff,
+				      0xff, 0xff, 0xff, 0xff, 0x01, 0};
+	write_chunk(out, wrap, sizeof(wrap));
+	// one far beyond anything the chunk could define
+	const unsigned char far[] = {'S', 0xff, 0xff, 0xff, 0x7f, 1, 'x'};
+	write_chunk(out, far, sizeof(far));
+
+	// a record whose field key refers to id -1
+	const unsigned char site[] = {
+		'S', 0, 1, 'm',
+		'C', 1, 1, 1, 'f', 1, 'g', 4, 'I', 'N', 'F', 'O',
+		'R', 1, 0, 0, 0, SLOG_TYPE_INT, 1, 0, 0};
+	write_chunk(out, site, sizeof(site));
+
+	// arrays nested past the decoder's limit
+	unsigned char deep[3 * 4096 + 6] = {'R', 1, 0, 0, 0};
+	size_t len = 5;
+	for (int i = 0; i < 4096; i++) {
+		deep[len++] = SLOG_TYPE_ARRAY;
+		deep[len++] = 0;
+	}
+	deep[len++] = 0;
+	write_chunk(out, deep, len);
+	fclose(out);
+
+	char command[256];
+	snprintf(command, sizeof(command), "%s %s 2>&1", decoder, path);
+	FILE *decoded = popen(command, "r");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+	char line[1024];
+	int corrupt = 0;
+	while (fgets(line, sizeof(line), decoded)) {
+		CU_ASSERT_STRING_EQUAL(line, "corrupt chunk\n");
+		corrupt++;
+	}
+	CU_ASSERT_NOT_EQUAL(pclose(decoded), 0);
+	CU_ASSERT_EQUAL(corrupt, 4);
+	unlink(path);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_binary = CU_add_suite("binary", NULL, suite_cleanup);
+	CU_add_test(suite_binary, "binary decodes to json",
+		    test_binary_decodes_to_json);
+	CU_add_test(suite_binary, "binary rejects corrupt chunks",
+		    test_binary_rejects_corrupt_chunks);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,97 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *captured = NULL;
+
+static void capture_handler(const char *str) {
+	free(captured);
+	captured = strdup(str);
+}
+
+static int suite_cleanup(void) {
+	SLOG_SET_CLOCK(SLOG_CLOCK_REALTIME, NULL);
+	SLOG_FREE();
+	free(captured);
+	captured = NULL;
+	return 0;
+}
+
+static struct timespec fixed;
+
+static void fixed_clock(struct timespec *ts) {
+	*ts = fixed;
+}
+
+void test_clock_callback_formatting(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fixed_clock);
+
+	// same second reuses the cached prefix, a new one replaces it
+	const struct timespec times[] = {
+		{1700000000, 42000},     {1700000000, 999999999},
+		{1700000001, 0},         {999, 100000},
+		{1700000001, 123456000},
+	};
+	const char *expected[] = {
+		"\"time\":\"1700000000.000042\"",
+		"\"time\":\"1700000000.999999\"",
+		"\"time\":\"1700000001.000000\"",
+		"\"time\":\"999.000100\"",
+		"\"time\":\"1700000001.123456\"",
+	};
+	for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+		fixed = times[i];
+		SLOG(SLOG_INFO, "clock",
+		     slog_node_create(SLOG_TYPE_TIME, "at"));
+		CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+		CU_ASSERT_PTR_NOT_NULL(strstr(captured, expected[i]));
+		char at[40];
+		snprintf(at, sizeof(at), "\"at\":%s",
+			 strchr(expected[i], ':') + 1);
+		CU_ASSERT_PTR_NOT_NULL(strstr(captured, at));
+	}
+}
+
+static double record_time(void) {
+	SLOG(SLOG_INFO, "clock");
+	const char *t = strstr(captured, "\"time\":\"");
+	return t ? strtod(t + 8, NULL) : 0;
+}
+
+static double realtime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void test_clock_sources_agree(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	const enum slog_clock sources[] = {SLOG_CLOCK_REALTIME,
+					   SLOG_CLOCK_COARSE, SLOG_CLOCK_TSC};
+	for (size_t i = 0; i < 3; i++) {
+		SLOG_SET_CLOCK(sources[i], NULL);
+		double last = 0;
+		for (int n = 0; n < 1000; n++) {
+			const double t = record_time();
+			CU_ASSERT(t >= last - 0.001);
+			last = t;
+		}
+		const double diff = realtime() - last;
+		CU_ASSERT(diff > -0.01 && diff < 0.1);
+	}
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_clock = CU_add_suite("clock", NULL, suite_cleanup);
+	CU_add_test(suite_clock, "callback formatting",
+		    test_clock_callback_formatting);
+	CU_add_test(suite_clock, "sources agree", test_clock_sources_agree);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,196 @@
+#include "slog_compress.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static char *read_file(const char *path, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return NULL;
+	}
+	struct stat st;
+	fstat(fileno(f), &st);
+	char *data = (char *)malloc((size_t)st.st_size + 1);
+	*len = fread(data, 1, (size_t)st.st_size, f);
+	fclose(f);
+	return data;
+}
+
+struct decoded {
+	int frames;
+	int records;
+	bool truncated; // the last frame is incomplete
+};
+
+static void count_records(struct decoded *d, const char *out, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		d->records += out[i] == '\n';
+	}
+}
+
+// Decodes every complete gzip member and counts the lines in them.
+static struct decoded gunzip_file(const char *path) {
+	struct decoded d = {0, 0, false};
+	size_t len;
+	char *data = read_file(path, &len);
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	inflateInit2(&z, 15 + 16);
+	z.next_in = (Bytef *)data;
+	z.avail_in = (uInt)len;
+	char out[65536];
+	while (z.avail_in) {
+		z.next_out = (Bytef *)out;
+		z.avail_out = sizeof(out);
+		const int ret = inflate(&z, Z_NO_FLUSH);
+		count_records(&d, out, sizeof(out) - z.avail_out);
+		if (ret == Z_STREAM_END) {
+			d.frames++;
+			inflateReset(&z);
+		} else if (ret != Z_OK) {
+			d.truncated = true;
+			break;
+		}
+	}
+	inflateEnd(&z);
+	free(data);
+	return d;
+}
+
+static int suite_cleanup(void) {
+	SLOG_RESET();
+	SLOG_FREE();
+	return 0;
+}
+
+void test_compress_gzip_frames(void) {
+	char path[] = "/tmp/slog-compress-XXXXXX";
+	close(mkstemp(path));
+
+	struct slog_compress_config config = {0};
+	config.path = path;
+	config.frame_bytes = 16 * 1024;
+	struct slog_compress *c = slog_compress_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+	SLOG_SET_COMPRESS(c);
+	for (int i = 0; i < 5000; i++) {
+		SLOG(SLOG_INFO, "compressed", SLOG_INT("i", i),
+		     SLOG_STRING("user", "bob"));
+	}
+	slog_compress_flush(c);
+	struct decoded d = gunzip_file(path);
+	CU_ASSERT_EQUAL(d.records, 5000);
+	CU_ASSERT(d.frames > 10);
+	CU_ASSERT_FALSE(d.truncated);
+
+	// a reopened file gets more frames
+	slog_compress_close(c);
+	c = slog_compress_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+	SLOG_SET_COMPRESS(c);
+	SLOG(SLOG_INFO, "again");
+	slog_compress_close(c);
+	SLOG_RESET();
+	d = gunzip_file(path);
+	CU_ASSERT_EQUAL(d.records, 5001);
+	CU_ASSERT_FALSE(d.truncated);
+
+	size_t len;
+	char *data = read_file(path, &len);
+	CU_ASSERT(len < 5001 * 20); // records are about 110 bytes
+	free(data);
+	unlink(path);
+}
+
+void test_compress_crash_loses_one_frame(void) {
+	char path[] = "/tmp/slog-compress-XXXXXX";
+	close(mkstemp(path));
+
+	const pid_t pid = fork();
+	CU_ASSERT_FATAL(pid >= 0);
+	if (pid == 0) {
+		struct slog_compress_config config = {0};
+		config.path = path;
+		config.frame_ms = 50;
+		struct slog_compress *c = slog_compress_open(&config);
+		if (!c) {
+			_exit(1);
+		}
+		SLOG_SET_COMPRESS(c);
+		for (int i = 0; i < 100; i++) {
+			SLOG(SLOG_INFO, "closed by time", SLOG_INT("i", i));
+		}
+		struct timespec pause = {0, 300 * 1000 * 1000};
+		nanosleep(&pause, NULL);
+		for (int i = 0; i < 100000; i++) {
+			SLOG(SLOG_INFO, "in the open frame", SLOG_INT("i", i));
+		}
+		raise(SIGKILL);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	CU_ASSERT(WIFSIGNALED(status));
+
+	const struct decoded d = gunzip_file(path);
+	CU_ASSERT(d.frames >= 1);
+	CU_ASSERT(d.records >= 100);
+	unlink(path);
+}
+
+#ifdef SLOG_HAVE_ZSTD
+void test_compress_zstd_frames(void) {
+	char path[] = "/tmp/slog-compress-XXXXXX";
+	close(mkstemp(path));
+
+	struct slog_compress_config config = {0};
+	config.path = path;
+	config.codec = SLOG_CODEC_ZSTD;
+	config.frame_bytes = 16 * 1024;
+	struct slog_compress *c = slog_compress_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+	SLOG_SET_COMPRESS(c);
+	for (int i = 0; i < 5000; i++) {
+		SLOG(SLOG_INFO, "compressed", SLOG_INT("i", i));
+	}
+	slog_compress_close(c);
+	SLOG_RESET();
+
+	size_t len;
+	char *data = read_file(path, &len);
+	struct decoded d = {0, 0, false};
+	ZSTD_DCtx *z = ZSTD_createDCtx();
+	ZSTD_inBuffer in = {data, len, 0};
+	char out[65536];
+	while (in.pos < in.size) {
+		ZSTD_outBuffer o = {out, sizeof(out), 0};
+		const size_t ret = ZSTD_decompressStream(z, &o, &in);
+		CU_ASSERT_FATAL(!ZSTD_isError(ret));
+		count_records(&d, out, o.pos);
+		d.frames += ret == 0;
+	}
+	ZSTD_freeDCtx(z);
+	free(data);
+	CU_ASSERT_EQUAL(d.records, 5000);
+	CU_ASSERT(d.frames > 10);
+	unlink(path);
+}
+#endif
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("compress", NULL, suite_cleanup);
+	CU_add_test(suite, "gzip frames", test_compress_gzip_frames);
+	CU_add_test(suite, "crash loses one frame",
+		    test_compress_crash_loses_one_frame);
+#ifdef SLOG_HAVE_ZSTD
+	CU_add_test(suite, "zstd frames", test_compress_zstd_frames);
+#endif
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
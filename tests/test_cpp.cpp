@@ -0,0 +1,116 @@
+#define SLOG_MODULE "frontend"
+#include "slog.hpp"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define MAX_LINES 8
+
+static char *lines[MAX_LINES];
+static int line_count = 0;
+
+static void capture_handler(const char *str) {
+	if (line_count < MAX_LINES) {
+		lines[line_count] = strdup(str);
+	}
+	line_count++;
+}
+
+static void clear_lines(void) {
+	for (int i = 0; i < line_count && i < MAX_LINES; i++) {
+		free(lines[i]);
+	}
+	line_count = 0;
+}
+
+static int suite_cleanup(void) {
+	SLOG_RESET();
+	SLOG_FREE();
+	clear_lines();
+	return 0;
+}
+
+static bool has(int line, const char *needle) {
+	return line < line_count && strstr(lines[line], needle) != NULL;
+}
+
+enum class color { red = 2 };
+
+static constexpr slog::key quoted{"say \"hi\"\n"};
+static_assert(std::string_view(quoted.json, quoted.len) ==
+	      "\"say \\\"hi\\\"\\n\":");
+
+void test_cpp_json(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_INFO);
+	clear_lines();
+
+	const std::string name = "ada";
+	const int line = __LINE__ + 1;
+	slog::info("login", slog::kv("user", name), slog::kv("id", 42),
+		   slog::kv("big", 18446744073709551615ull),
+		   slog::kv("ok", true), slog::kv("ratio", 0.5),
+		   slog::kv("color", color::red), slog::kv(quoted, 'x'),
+		   slog::kv("tags", slog::array("a", 1)),
+		   slog::kv("req", slog::object(slog::kv("path", "/"))),
+		   slog::kv("extra", slog::raw("[null]")));
+	slog::debug("filtered", slog::kv("id", 1));
+	CU_ASSERT_EQUAL_FATAL(line_count, 1);
+	CU_ASSERT(has(0, "\"level\":\"INFO\""));
+	CU_ASSERT(has(0, "\"msg\":\"login\",\"user\":\"ada\",\"id\":42,"
+			 "\"big\":18446744073709551615,\"ok\":true,"
+			 "\"ratio\":0.5,\"color\":2,"
+			 "\"say \\\"hi\\\"\\n\":\"x\","
+			 "\"tags\":[\"a\",1],\"req\":{\"path\":\"/\"},"
+			 "\"extra\":[null]}"));
+	const std::string where = "test_cpp.cpp\",\"line\":" +
+				  std::to_string(line) +
+				  ",\"func\":\"test_cpp_json\"";
+	CU_ASSERT(has(0, where.c_str()));
+}
+
+void test_cpp_encoding(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_ENCODING(SLOG_ENCODING_LOGFMT);
+	clear_lines();
+
+	for (int i = 0; i < 2; i++) {
+		slog::warn("retry", slog::kv("attempt", i),
+			   slog::kv("host", "db 1"));
+	}
+	SLOG_SET_ENCODING(SLOG_ENCODING_JSON);
+	CU_ASSERT_EQUAL_FATAL(line_count, 2);
+	CU_ASSERT(has(1, "msg=retry attempt=1 host=\"db 1\""));
+}
+
+void test_cpp_module(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_WARN);
+	clear_lines();
+
+	// nothing takes debug records until the module does
+	slog::debug("hidden");
+	CU_ASSERT_EQUAL(line_count, 0);
+	CU_ASSERT(SLOG_SET_MODULE_LEVEL("frontend", SLOG_DEBUG));
+	slog::debug("shown", slog::kv("n", 1));
+	CU_ASSERT_EQUAL_FATAL(line_count, 1);
+	CU_ASSERT(has(0, "\"msg\":\"shown\",\"n\":1}"));
+	CU_ASSERT(SLOG_SET_MODULE_LEVEL("frontend", SLOG_WARN));
+	slog::debug("shown");
+	CU_ASSERT_EQUAL(line_count, 1);
+	SLOG_RESET();
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("cpp", NULL, suite_cleanup);
+	CU_add_test(suite, "cpp json", test_cpp_json);
+	CU_add_test(suite, "cpp encoding", test_cpp_encoding);
+	CU_add_test(suite, "cpp module", test_cpp_module);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,125 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+static void stuck_writer(const struct slog_record *record) {
+	(void)record;
+	for (;;) {
+		pause();
+	}
+}
+
+static void user_queue(int fd, void *arg) {
+	slog_crash_write(fd, arg, strlen((const char *)arg));
+}
+
+// Runs crash in a child process and returns the signal that ended it.
+static int run_crashing(void (*crash)(const char *path, const char *bin),
+			const char *path, const char *bin) {
+	const pid_t pid = fork();
+	if (pid == 0) {
+		crash(path, bin);
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+}
+
+static int count_lines(FILE *f, const char *needle, char *last, size_t size) {
+	char line[1024];
+	int n = 0;
+	while (fgets(line, sizeof(line), f)) {
+		n += strstr(line, needle) != NULL;
+		snprintf(last, size, "%s", line);
+	}
+	return n;
+}
+
+static void crash_queued(const char *path, const char *bin) {
+	(void)bin;
+	SLOG_CRASH_HANDLER(open(path, O_WRONLY | O_APPEND));
+	SLOG_CRASH_HOOK(user_queue, (void *)"{\"msg\":\"from a hook\"}\n");
+	struct slog_async_config config = {0};
+	config.capacity = 16;
+	config.writer = stuck_writer;
+	SLOG_ASYNC_START(&config);
+	SLOG(SLOG_INFO, "taken by the writer");
+	struct timespec pause = {0, 50 * 1000 * 1000};
+	nanosleep(&pause, NULL);
+	for (int i = 0; i < 9; i++) {
+		SLOG(SLOG_INFO, "queued", SLOG_INT("i", i));
+	}
+	abort();
+}
+
+void test_crash_flushes_queue(void) {
+	char path[] = "/tmp/slog-crash-XXXXXX";
+	close(mkstemp(path));
+	CU_ASSERT_EQUAL(run_crashing(crash_queued, path, NULL), SIGABRT);
+
+	FILE *f = fopen(path, "r");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+	char last[1024] = "";
+	CU_ASSERT_EQUAL(
+		count_lines(f, "\"msg\":\"queued\"", last, sizeof(last)), 9);
+	rewind(f);
+	CU_ASSERT_EQUAL(count_lines(f, "from a hook", last, sizeof(last)), 1);
+	fclose(f);
+	CU_ASSERT_PTR_NOT_NULL(
+		strstr(last, "\"msg\":\"crash\",\"signal\":\"SIGABRT\""));
+	CU_ASSERT_PTR_NOT_NULL(strstr(last, "\"pid\":"));
+	unlink(path);
+}
+
+static void crash_binary(const char *path, const char *bin) {
+	SLOG_CRASH_HANDLER(open(path, O_WRONLY | O_APPEND));
+	SLOG_BINARY_START(open(bin, O_WRONLY | O_APPEND));
+	for (int i = 0; i < 5; i++) {
+		SLOG(SLOG_WARN, "pending", SLOG_INT("i", i));
+	}
+	raise(SIGILL);
+}
+
+void test_crash_flushes_binary(void) {
+	const char *decoder = getenv("SLOG_DECODE");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoder);
+	char path[] = "/tmp/slog-crash-XXXXXX";
+	char bin[] = "/tmp/slog-crash-XXXXXX";
+	close(mkstemp(path));
+	close(mkstemp(bin));
+	CU_ASSERT_EQUAL(run_crashing(crash_binary, path, bin), SIGILL);
+
+	char command[256];
+	snprintf(command, sizeof(command), "%s %s", decoder, bin);
+	FILE *decoded = popen(command, "r");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+	char last[1024] = "";
+	CU_ASSERT_EQUAL(count_lines(decoded, "\"i\":", last, sizeof(last)), 5);
+	CU_ASSERT_EQUAL(pclose(decoded), 0);
+
+	FILE *f = fopen(path, "r");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+	CU_ASSERT_EQUAL(count_lines(f, "\"signal\":\"SIGILL\"", last,
+				    sizeof(last)),
+			1);
+	fclose(f);
+	unlink(path);
+	unlink(bin);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("crash", NULL, NULL);
+	CU_add_test(suite, "crash flushes queue", test_crash_flushes_queue);
+	CU_add_test(suite, "crash flushes binary", test_crash_flushes_binary);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
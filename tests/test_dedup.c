@@ -0,0 +1,118 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINES 16
+
+static char *lines[MAX_LINES];
+static int line_count = 0;
+static long long fake_ms = 1000;
+
+static void capture_handler(const char *str) {
+	if (line_count < MAX_LINES) {
+		lines[line_count] = strdup(str);
+	}
+	line_count++;
+}
+
+static void clear_lines(void) {
+	for (int i = 0; i < line_count && i < MAX_LINES; i++) {
+		free(lines[i]);
+	}
+	line_count = 0;
+}
+
+static void fake_clock(struct timespec *ts) {
+	ts->tv_sec = fake_ms / 1000;
+	ts->tv_nsec = fake_ms % 1000 * 1000000;
+}
+
+static int suite_cleanup(void) {
+	SLOG_SET_DEDUP(0);
+	SLOG_SET_CLOCK(SLOG_CLOCK_REALTIME, NULL);
+	SLOG_RESET();
+	SLOG_FREE();
+	clear_lines();
+	return 0;
+}
+
+static void query_failed(const char *db) {
+	SLOG(SLOG_ERROR, "query failed", SLOG_STRING("db", db));
+}
+
+static bool has(int line, const char *needle) {
+	return line < line_count && strstr(lines[line], needle) != NULL;
+}
+
+void test_dedup_repeats(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fake_clock);
+	SLOG_SET_DEDUP(1000);
+	clear_lines();
+
+	for (int i = 0; i < 100; i++) {
+		fake_ms++;
+		query_failed("users");
+	}
+	CU_ASSERT_EQUAL(line_count, 1);
+
+	// a different body ends the window; the summary follows it
+	fake_ms++;
+	query_failed("orders");
+	CU_ASSERT_EQUAL_FATAL(line_count, 3);
+	CU_ASSERT(has(1, "\"db\":\"orders\""));
+	CU_ASSERT(has(2, "\"msg\":\"repeated\",\"count\":99,"));
+	CU_ASSERT(has(2, "\"first\":\"1.002000\",\"last\":\"1.100000\""));
+	CU_ASSERT(has(2, "\"level\":\"ERROR\""));
+
+	// other callsites are not affected
+	SLOG(SLOG_INFO, "query failed", SLOG_STRING("db", "orders"));
+	CU_ASSERT_EQUAL(line_count, 4);
+}
+
+void test_dedup_window_end(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fake_clock);
+	SLOG_SET_DEDUP(1000);
+	clear_lines();
+
+	fake_ms = 10000;
+	for (int i = 0; i < 10; i++) {
+		SLOG_FIELDS(SLOG_WARN, "retry", SLOG_FIELD_INT("attempt", 1));
+	}
+	CU_ASSERT_EQUAL(line_count, 1);
+
+	// any record after the window writes the pending summary
+	fake_ms += 1000;
+	SLOG(SLOG_INFO, "unrelated");
+	CU_ASSERT_EQUAL_FATAL(line_count, 3);
+	CU_ASSERT(has(1, "\"msg\":\"unrelated\""));
+	CU_ASSERT(has(2, "\"msg\":\"repeated\",\"count\":9,"));
+
+	// the next repeat opens a new window; SLOG_FLUSH ends it early
+	for (int i = 0; i < 3; i++) {
+		SLOG_FIELDS(SLOG_WARN, "retry", SLOG_FIELD_INT("attempt", 1));
+	}
+	CU_ASSERT_EQUAL(line_count, 4);
+	SLOG_FLUSH();
+	CU_ASSERT_EQUAL(line_count, 5);
+	CU_ASSERT(has(4, "\"count\":2,"));
+
+	SLOG_SET_DEDUP(0);
+	SLOG_FIELDS(SLOG_WARN, "retry", SLOG_FIELD_INT("attempt", 1));
+	SLOG_FIELDS(SLOG_WARN, "retry", SLOG_FIELD_INT("attempt", 1));
+	CU_ASSERT_EQUAL(line_count, 7);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("dedup", NULL, suite_cleanup);
+	CU_add_test(suite, "dedup repeats", test_dedup_repeats);
+	CU_add_test(suite, "dedup window end", test_dedup_window_end);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
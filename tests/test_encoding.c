@@ -0,0 +1,136 @@
+#define _GNU_SOURCE // memmem
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <string.h>
+
+static unsigned char captured[1024];
+static size_t captured_len = 0;
+
+static void capture_writer(const struct slog_record *record) {
+	captured_len = record->len;
+	if (captured_len > sizeof(captured)) {
+		captured_len = sizeof(captured);
+	}
+	memcpy(captured, record->data, captured_len);
+}
+
+static int suite_cleanup(void) {
+	SLOG_SET_ENCODING(SLOG_ENCODING_JSON);
+	SLOG_SET_CLOCK(SLOG_CLOCK_REALTIME, NULL);
+	SLOG_FREE();
+	return 0;
+}
+
+static void fixed_clock(struct timespec *ts) {
+	ts->tv_sec = 1700000000;
+	ts->tv_nsec = 123000;
+}
+
+static bool captured_has(const void *bytes, size_t len) {
+	return memmem(captured, captured_len, bytes, len) != NULL;
+}
+
+static bool captured_ends_with(const void *bytes, size_t len) {
+	return captured_len >= len &&
+	       !memcmp(captured + captured_len - len, bytes, len);
+}
+
+void test_encoding_logfmt(void) {
+	SLOG_SET_WRITER(capture_writer, false);
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fixed_clock);
+	SLOG_SET_ENCODING(SLOG_ENCODING_LOGFMT);
+
+	SLOG(SLOG_INFO, "hi there", SLOG_STRING("user", "bob"),
+	     SLOG_OBJECT("meta", SLOG_INT("id", 7),
+			 SLOG_ARRAY("tags", SLOG_STRING(NULL, "a"),
+				    SLOG_STRING(NULL, "b \"c\""))),
+	     SLOG_FLOAT("score", 1.5), SLOG_BOOL("ok", true),
+	     SLOG_STRING("bad key=", ""), SLOG_OBJECT("empty"));
+	const char *expected =
+		" level=INFO time=1700000000.000123 msg=\"hi there\" user=bob"
+		" meta.id=7 meta.tags.0=a meta.tags.1=\"b \\\"c\\\"\""
+		" score=1.5 ok=true bad_key_=\"\" empty={}";
+	CU_ASSERT(captured_ends_with(expected, strlen(expected)));
+	CU_ASSERT_EQUAL(memcmp(captured, "file=", 5), 0);
+
+	SLOG_FIELDS(SLOG_WARN, "fields",
+		    SLOG_FIELD_ARRAY("ids", SLOG_FIELD_INT(NULL, 1),
+				     SLOG_FIELD_OBJECT(NULL,
+						       SLOG_FIELD_INT("x", 2))));
+	const char *fields = " msg=fields ids.0=1 ids.1.x=2";
+	CU_ASSERT(captured_ends_with(fields, strlen(fields)));
+}
+
+void test_encoding_cbor(void) {
+	SLOG_SET_WRITER(capture_writer, false);
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fixed_clock);
+	SLOG_SET_ENCODING(SLOG_ENCODING_CBOR);
+
+	SLOG_FIELDS(SLOG_INFO, "m", SLOG_FIELD_INT("n", -500),
+		    SLOG_FIELD_ARRAY("a", SLOG_FIELD_INT(NULL, 1),
+				     SLOG_FIELD_FLOAT(NULL, 0.5),
+				     SLOG_FIELD_BOOL(NULL, true)));
+	CU_ASSERT_EQUAL(captured[0], 0xa8); // map of 8
+	const unsigned char level[] = {0x65, 'l', 'e', 'v', 'e', 'l',
+				       0x64, 'I', 'N', 'F', 'O'};
+	CU_ASSERT(captured_has(level, sizeof(level)));
+	const unsigned char tail[] = {
+		0x63, 'm',  's',  'g',  0x61, 'm',  0x61, 'n',  0x39,
+		0x01, 0xf3, 0x61, 'a',  0x83, 0x01, 0xfb, 0x3f, 0xe0,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf5};
+	CU_ASSERT(captured_ends_with(tail, sizeof(tail)));
+
+	// tag 1, then the epoch time as a float64
+	const unsigned char time[] = {0x64, 't', 'i', 'm', 'e', 0xc1, 0xfb};
+	const unsigned char *t = (const unsigned char *)memmem(
+		captured, captured_len, time, sizeof(time));
+	CU_ASSERT_PTR_NOT_NULL(t);
+	if (t) {
+		uint64_t bits = 0;
+		for (int i = 0; i < 8; i++) {
+			bits = bits << 8 | t[7 + i];
+		}
+		double seconds;
+		memcpy(&seconds, &bits, sizeof(seconds));
+		CU_ASSERT_DOUBLE_EQUAL(seconds, 1700000000.000123, 1e-6);
+	}
+}
+
+void test_encoding_msgpack(void) {
+	SLOG_SET_WRITER(capture_writer, false);
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fixed_clock);
+	SLOG_SET_ENCODING(SLOG_ENCODING_MSGPACK);
+
+	struct slog_logger *logger =
+		SLOG_LOGGER(NULL, SLOG_INT("big", 70000));
+	SLOG_WITH(logger, SLOG_INFO, "m", SLOG_INT("n", -500),
+		  SLOG_OBJECT("o", SLOG_STRING("s", "x")));
+	SLOG_LOGGER_FREE(logger);
+	CU_ASSERT_EQUAL(captured[0], 0x89); // map of 9
+
+	// timestamp 64: nanoseconds << 34 | seconds
+	const uint64_t stamp = (uint64_t)123000 << 34 | 1700000000u;
+	unsigned char time[10] = {0xd7, 0xff};
+	for (int i = 0; i < 8; i++) {
+		time[2 + i] = (unsigned char)(stamp >> (56 - 8 * i));
+	}
+	CU_ASSERT(captured_has(time, sizeof(time)));
+	const unsigned char tail[] = {
+		0xa3, 'm', 's',  'g',  0xa1, 'm',  0xa3, 'b',  'i',  'g',
+		0xce, 0x00, 0x01, 0x11, 0x70, 0xa1, 'n',  0xd1, 0xfe, 0x0c,
+		0xa1, 'o', 0x81, 0xa1, 's',  0xa1, 'x'};
+	CU_ASSERT(captured_ends_with(tail, sizeof(tail)));
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("encoding", NULL, suite_cleanup);
+	CU_add_test(suite, "logfmt", test_encoding_logfmt);
+	CU_add_test(suite, "cbor", test_encoding_cbor);
+	CU_add_test(suite, "msgpack", test_encoding_msgpack);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
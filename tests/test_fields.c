@@ -0,0 +1,89 @@
+#include <stdlib.h>
+
+static int allocations = 0;
+
+static void *counting_malloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+static void *counting_calloc(size_t n, size_t size) {
+	allocations++;
+	return calloc(n, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+	allocations++;
+	return realloc(ptr, size);
+}
+
+// count every allocation slog.h makes
+#define malloc(size) counting_malloc(size)
+#define calloc(n, size) counting_calloc(n, size)
+#define realloc(ptr, size) counting_realloc(ptr, size)
+
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <string.h>
+
+static char captured[1024];
+static int handler_calls = 0;
+
+static void capture_handler(const char *str) {
+	handler_calls++;
+	strncpy(captured, str, sizeof(captured) - 1);
+}
+
+static int suite_cleanup(void) {
+	SLOG_FREE();
+	handler_calls = 0;
+	return 0;
+}
+
+static void log_fields(int i) {
+	SLOG_FIELDS(SLOG_INFO, "fields", SLOG_FIELD_STRING("user", "bob"),
+		    SLOG_FIELD_INT("id", i), SLOG_FIELD_FLOAT("score", 96.5),
+		    SLOG_FIELD_BOOL("active", true),
+		    SLOG_FIELD_ARRAY("ids", SLOG_FIELD_INT("dropped", 1),
+				     SLOG_FIELD_INT(NULL, 2)),
+		    SLOG_FIELD_OBJECT("meta", SLOG_FIELD_OBJECT("empty")));
+}
+
+void test_fields_match_nodes(void) {
+	SLOG_SET_HANDLER(capture_handler);
+
+	log_fields(7);
+	CU_ASSERT_PTR_NOT_NULL(strstr(
+		captured, "\"msg\":\"fields\",\"user\":\"bob\",\"id\":7,"
+			  "\"score\":96.5,\"active\":true,\"ids\":[1,2],"
+			  "\"meta\":{\"empty\":{}}}"));
+
+	SLOG_FIELDS(SLOG_WARN, "no fields");
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"msg\":\"no fields\"}"));
+}
+
+void test_fields_do_not_allocate(void) {
+	SLOG_SET_HANDLER(capture_handler);
+
+	log_fields(0); // warms the buffer and the callsite and key caches
+	allocations = 0;
+	handler_calls = 0;
+	for (int i = 0; i < 1000; i++) {
+		log_fields(i);
+	}
+	CU_ASSERT_EQUAL(handler_calls, 1000);
+	CU_ASSERT_EQUAL(allocations, 0);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_fields = CU_add_suite("fields", NULL, suite_cleanup);
+	CU_add_test(suite_fields, "fields match nodes", test_fields_match_nodes);
+	CU_add_test(suite_fields, "fields do not allocate",
+		    test_fields_do_not_allocate);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,261 @@
+#include "slog_file.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 4
+#define RECORDS 500
+
+static char dir[] = "/tmp/slog_file_XXXXXX";
+static char path[64];
+
+static int suite_init(void) {
+	if (!mkdtemp(dir)) {
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/app.log", dir);
+	return 0;
+}
+
+static int suite_cleanup(void) {
+	SLOG_FREE();
+	DIR *d = opendir(dir);
+	for (struct dirent *e; d && (e = readdir(d));) {
+		char name[512];
+		snprintf(name, sizeof(name), "%s/%s", dir, e->d_name);
+		if (e->d_name[0] != '.') {
+			unlink(name);
+		}
+	}
+	if (d) {
+		closedir(d);
+	}
+	rmdir(dir);
+	return 0;
+}
+
+// Counts lines in every file of the directory; returns the number of files.
+static int count_lines(int *lines) {
+	int files = 0;
+	*lines = 0;
+	DIR *d = opendir(dir);
+	for (struct dirent *e; d && (e = readdir(d));) {
+		if (e->d_name[0] == '.') {
+			continue;
+		}
+		char name[512];
+		snprintf(name, sizeof(name), "%s/%s", dir, e->d_name);
+		FILE *fp = fopen(name, "r");
+		for (int c; fp && (c = fgetc(fp)) != EOF;) {
+			*lines += c == '\n';
+		}
+		if (fp) {
+			fclose(fp);
+		}
+		files++;
+	}
+	if (d) {
+		closedir(d);
+	}
+	return files;
+}
+
+static struct slog_file *sink = NULL;
+
+static void *log_worker(void *arg) {
+	(void)arg;
+	SLOG_SET_FILE(sink);
+	for (int i = 0; i < RECORDS; i++) {
+		SLOG(SLOG_INFO, "to file", SLOG_INT("i", i));
+	}
+	SLOG_FREE();
+	return NULL;
+}
+
+void test_file_all_records_written(void) {
+	// small buffers so records span buffers and producers have to wait
+	struct slog_file_config config = {
+		.path = path,
+		.buffer_size = 100,
+		.buffers = 3,
+	};
+	sink = slog_file_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sink);
+
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, log_worker, NULL);
+	}
+	for (int i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	slog_file_flush(sink);
+
+	int lines;
+	CU_ASSERT_EQUAL(count_lines(&lines), 1);
+	CU_ASSERT_EQUAL(lines, THREADS * RECORDS);
+	slog_file_close(sink);
+}
+
+void test_file_latency_bound(void) {
+	struct slog_file_config config = {
+		.path = path,
+		.latency_ms = 10,
+	};
+	unlink(path);
+	sink = slog_file_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sink);
+	SLOG_SET_FILE(sink);
+	SLOG(SLOG_INFO, "eventually on disk");
+
+	// no flush: the writer picks the record up once it is 10ms old
+	int lines = 0;
+	for (int i = 0; i < 200 && !lines; i++) {
+		usleep(5000);
+		count_lines(&lines);
+	}
+	CU_ASSERT_EQUAL(lines, 1);
+	slog_file_close(sink);
+	SLOG_FREE();
+	unlink(path);
+}
+
+void test_file_rotation(void) {
+	struct slog_file_config config = {
+		.path = path,
+		.buffer_size = 512,
+		.max_bytes = 2048,
+	};
+	sink = slog_file_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sink);
+	SLOG_SET_FILE(sink);
+	for (int i = 0; i < 200; i++) {
+		SLOG(SLOG_INFO, "rotated", SLOG_INT("i", i));
+		if (i % 20 == 0) {
+			slog_file_flush(sink);
+		}
+	}
+	slog_file_flush(sink);
+	CU_ASSERT(sink->rotations > 0);
+
+	int lines;
+	CU_ASSERT_EQUAL(count_lines(&lines), (int)sink->rotations + 1);
+	CU_ASSERT_EQUAL(lines, 200);
+	slog_file_close(sink);
+	SLOG_FREE();
+}
+
+void test_file_rotation_failure(void) {
+	// the rotated name is longer than a file name may be
+	char name[300];
+	snprintf(name, sizeof(name), "%s/%0250d", dir, 0);
+	struct slog_file_config config = {
+		.path = name,
+		.buffer_size = 512,
+		.max_bytes = 1024,
+	};
+	char errors[] = "/tmp/slog_file_errors_XXXXXX";
+	const int err = mkstemp(errors);
+	CU_ASSERT_FATAL(err >= 0);
+	fflush(stderr);
+	const int saved = dup(2);
+	dup2(err, 2);
+
+	sink = slog_file_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sink);
+	SLOG_SET_FILE(sink);
+	for (int i = 0; i < 100; i++) {
+		SLOG(SLOG_INFO, "not rotated", SLOG_INT("i", i));
+		if (i % 10 == 0) {
+			slog_file_flush(sink);
+		}
+	}
+	slog_file_flush(sink);
+	CU_ASSERT_EQUAL(sink->rotations, 0);
+	slog_file_close(sink);
+	SLOG_FREE();
+	fflush(stderr);
+	dup2(saved, 2);
+	close(saved);
+
+	// reported once, and every record still reached the file
+	char text[4096];
+	const ssize_t n = pread(err, text, sizeof(text) - 1, 0);
+	close(err);
+	unlink(errors);
+	CU_ASSERT_FATAL(n > 0);
+	text[n] = '\0';
+	const char *first = strstr(text, "rotation failed");
+	CU_ASSERT_PTR_NOT_NULL(first);
+	CU_ASSERT_PTR_NULL(first ? strstr(first + 1, "rotation failed") : NULL);
+
+	int lines = 0;
+	FILE *fp = fopen(name, "r");
+	for (int c; fp && (c = fgetc(fp)) != EOF;) {
+		lines += c == '\n';
+	}
+	if (fp) {
+		fclose(fp);
+	}
+	CU_ASSERT_EQUAL(lines, 100);
+	unlink(name);
+}
+
+static bool producing;
+
+static void *busy_worker(void *arg) {
+	(void)arg;
+	while (__atomic_load_n(&producing, __ATOMIC_RELAXED)) {
+		slog_file_write(sink, "busy", 4);
+	}
+	return NULL;
+}
+
+void test_file_flush_under_load(void) {
+	struct slog_file_config config = {
+		.path = path,
+		.buffer_size = 64 * 1024,
+		.buffers = 8,
+	};
+	unlink(path);
+	sink = slog_file_open(&config);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(sink);
+
+	// flushes return even though the buffers never run empty
+	__atomic_store_n(&producing, true, __ATOMIC_RELAXED);
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, busy_worker, NULL);
+	}
+	for (int i = 0; i < 50; i++) {
+		slog_file_flush(sink);
+	}
+	__atomic_store_n(&producing, false, __ATOMIC_RELAXED);
+	for (int i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	slog_file_close(sink);
+
+	struct stat st;
+	CU_ASSERT(stat(path, &st) == 0 && st.st_size > 0);
+	unlink(path);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_file = CU_add_suite("file", suite_init, suite_cleanup);
+	CU_add_test(suite_file, "all records written",
+		    test_file_all_records_written);
+	CU_add_test(suite_file, "latency bound", test_file_latency_bound);
+	CU_add_test(suite_file, "rotation", test_file_rotation);
+	CU_add_test(suite_file, "rotation failure",
+		    test_file_rotation_failure);
+	CU_add_test(suite_file, "flush under load",
+		    test_file_flush_under_load);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -14,6 +14,7 @@ static void capture_handler(const char *str) {
 }
 
 static int suite_cleanup(void) {
+	SLOG_RESET();
 	SLOG_FREE();
 	free(captured);
 	captured = NULL;
@@ -33,12 +34,87 @@ void test_handler_receives_output(void) {
 	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"id\":7"));
 }
 
+static struct slog_record kept[4];
+static size_t kept_count = 0;
+
+static void keeping_writer(const struct slog_record *record) {
+	if (kept_count < 4) {
+		kept[kept_count++] = *record;
+	} else {
+		SLOG_RECORD_RELEASE(record);
+	}
+}
+
+static void fixed_clock(struct timespec *ts) {
+	ts->tv_sec = 1700000000;
+	ts->tv_nsec = 5000;
+}
+
+void test_writer_receives_record(void) {
+	SLOG_SET_CLOCK(SLOG_CLOCK_CALLBACK, fixed_clock);
+	SLOG_SET_WRITER(keeping_writer, true);
+
+	SLOG(SLOG_ERROR, "first", SLOG_INT("id", 1));
+	SLOG(SLOG_INFO, "second");
+	SLOG_SET_CLOCK(SLOG_CLOCK_REALTIME, NULL);
+	CU_ASSERT_EQUAL_FATAL(kept_count, 2);
+
+	// each record kept its own buffer
+	CU_ASSERT_PTR_NOT_EQUAL(kept[0].data, kept[1].data);
+	CU_ASSERT_EQUAL(kept[0].len, strlen(kept[0].data));
+	CU_ASSERT_PTR_NOT_NULL(strstr(kept[0].data, "\"msg\":\"first\""));
+	CU_ASSERT_PTR_NOT_NULL(strstr(kept[1].data, "\"msg\":\"second\""));
+	CU_ASSERT_EQUAL(kept[0].level, SLOG_ERROR);
+	CU_ASSERT_EQUAL(kept[1].level, SLOG_INFO);
+	CU_ASSERT_EQUAL(kept[0].time.tv_sec, 1700000000);
+	CU_ASSERT_EQUAL(kept[0].time.tv_nsec, 5000);
+	CU_ASSERT(kept[0].size > kept[0].len);
+
+	// released buffers are reused by the next records
+	char *first = kept[0].data;
+	SLOG_RECORD_RELEASE(&kept[0]);
+	SLOG_RECORD_RELEASE(&kept[1]);
+	kept_count = 0;
+	SLOG(SLOG_INFO, "third");
+	SLOG(SLOG_INFO, "fourth");
+	CU_ASSERT_EQUAL_FATAL(kept_count, 2);
+	CU_ASSERT(kept[1].data == first || kept[0].data == first);
+	SLOG_RECORD_RELEASE(&kept[0]);
+	SLOG_RECORD_RELEASE(&kept[1]);
+	kept_count = 0;
+}
+
+void test_writer_async_ownership(void) {
+	SLOG_SET_WRITER(keeping_writer, true);
+	struct slog_async_config config = {0};
+	config.capacity = 16;
+	CU_ASSERT_TRUE_FATAL(SLOG_ASYNC_START(&config));
+
+	SLOG(SLOG_WARN, "queued", SLOG_INT("id", 1));
+	SLOG(SLOG_DEBUG, "queued");
+	SLOG_FLUSH();
+	SLOG_ASYNC_STOP();
+	CU_ASSERT_EQUAL_FATAL(kept_count, 2);
+	CU_ASSERT_PTR_NOT_EQUAL(kept[0].data, kept[1].data);
+	CU_ASSERT_EQUAL(kept[0].level, SLOG_WARN);
+	CU_ASSERT_EQUAL(kept[1].level, SLOG_DEBUG);
+	CU_ASSERT_EQUAL(kept[0].len, strlen(kept[0].data));
+	CU_ASSERT_PTR_NOT_NULL(strstr(kept[0].data, "\"id\":1"));
+	SLOG_RECORD_RELEASE(&kept[0]);
+	SLOG_RECORD_RELEASE(&kept[1]);
+	kept_count = 0;
+}
+
 int main(void) {
 	CU_initialize_registry();
 
 	CU_pSuite suite_handler = CU_add_suite("handler", NULL, suite_cleanup);
 	CU_add_test(suite_handler, "handler receives output",
 		    test_handler_receives_output);
+	CU_add_test(suite_handler, "writer receives record",
+		    test_writer_receives_record);
+	CU_add_test(suite_handler, "writer async ownership",
+		    test_writer_async_ownership);
 
 	CU_basic_run_tests();
 	CU_cleanup_registry();
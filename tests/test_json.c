@@ -1,8 +1,12 @@
 #include "slog.h"
 #include <CUnit/Basic.h>
 #include <CUnit/CUnit.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static char *captured = NULL;
 
@@ -61,12 +65,207 @@ void test_json_escape(void) {
 	assert_contains(captured, "\"note\":\"line\\nbreak\"");
 }
 
+void test_json_escape_long(void) {
+	SLOG_SET_HANDLER(capture_handler);
+
+	// escapes land on both sides of every 16/32 byte block boundary
+	char payload[80];
+	for (size_t i = 0; i < sizeof(payload) - 1; i++) {
+		payload[i] = (i % 15 == 14) ? '\x01' : 'a' + (char)(i % 26);
+	}
+	payload[sizeof(payload) - 1] = '\0';
+
+	char expected[sizeof(payload) * 6 + 16] = "\"p\":\"";
+	char *out = expected + strlen(expected);
+	for (const char *p = payload; *p; p++) {
+		out += *p == '\x01' ? sprintf(out, "\\u0001")
+				    : sprintf(out, "%c", *p);
+	}
+	strcpy(out, "\"");
+
+	SLOG(SLOG_INFO, "long", SLOG_STRING("p", payload),
+	     SLOG_STRING("utf8", "h\xc3\xa9llo \xe4\xb8\x96\xe7\x95\x8c \t\\ \x1f"));
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+	assert_contains(captured, expected);
+	assert_contains(captured, "\"utf8\":\"h\xc3\xa9llo "
+				  "\xe4\xb8\x96\xe7\x95\x8c \\t\\\\ \\u001f\"");
+}
+
+void test_json_numbers(void) {
+	SLOG_SET_HANDLER(capture_handler);
+
+	SLOG(SLOG_INFO, "numbers", SLOG_INT("min", LLONG_MIN),
+	     SLOG_INT("max", LLONG_MAX), SLOG_INT("neg", -42),
+	     SLOG_FLOAT("score", 96.5), SLOG_FLOAT("tiny", 1.5e-9),
+	     SLOG_FLOAT("huge", 6.02214076e23), SLOG_FLOAT("third", 1.0 / 3),
+	     SLOG_FLOAT("whole", 2.0), SLOG_FLOAT("nan", NAN),
+	     SLOG_BOOL("off", false));
+
+	CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+	assert_contains(captured, "\"min\":-9223372036854775808");
+	assert_contains(captured, "\"max\":9223372036854775807");
+	assert_contains(captured, "\"neg\":-42");
+	assert_contains(captured, "\"score\":96.5,");
+	assert_contains(captured, "\"tiny\":1.5e-9,");
+	assert_contains(captured, "\"huge\":6.02214076e23,");
+	assert_contains(captured, "\"third\":0.3333333333333333,");
+	assert_contains(captured, "\"whole\":2.0,");
+	assert_contains(captured, "\"nan\":\"NaN\"");
+	assert_contains(captured, "\"off\":false");
+}
+
+void test_json_float_round_trip(void) {
+	const double values[] = {0.1, 5e-324, DBL_MAX, DBL_MIN, 123456.789e-300,
+				 9007199254740993.0, -2.5e-10, 1e21};
+
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		slog_buffer.index = 0;
+		slog_write_double(values[i]);
+		const char *text = slog_buffer_flush_and_reset();
+		CU_ASSERT_PTR_NOT_NULL_FATAL(text);
+		CU_ASSERT_EQUAL(strtod(text, NULL), values[i]);
+	}
+}
+
+void test_json_cached_fragments(void) {
+	SLOG_SET_HANDLER(capture_handler);
+
+	// same callsite and key pointer, different key contents
+	char key[16];
+	const char *expected[] = {"\"first\":0", "\"sec\\\"nd\":1"};
+	for (int i = 0; i < 2; i++) {
+		strcpy(key, i ? "sec\"nd" : "first");
+		SLOG(SLOG_WARN, "cached", SLOG_INT(key, i));
+		CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+		CU_ASSERT_NSTRING_EQUAL(captured, "{\"file\":\"", 9);
+		assert_contains(captured, "\"level\":\"WARN\",\"time\":\"");
+		assert_contains(captured, expected[i]);
+	}
+}
+
+void test_json_slices_and_raw(void) {
+	SLOG_SET_HANDLER(capture_handler);
+
+	const char line[] = "GET /a\"b HTTP/1.1\r\nHost: x";
+	const char payload[] = "{\"ids\":[1,2],\"ok\":true}";
+	SLOG(SLOG_INFO, "slices", SLOG_STRING_N("request", line, 13),
+	     SLOG_RAW("payload", payload, strlen(payload)),
+	     SLOG_TRUSTED("id", "abc-123"));
+	assert_contains(captured, "\"request\":\"GET /a\\\"b HTTP\",");
+	assert_contains(captured, "\"payload\":{\"ids\":[1,2],\"ok\":true},");
+	assert_contains(captured, "\"id\":\"abc-123\"}");
+
+	SLOG_FIELDS(SLOG_INFO, "slices",
+		    SLOG_FIELD_STRING_N("request", line, 3),
+		    SLOG_FIELD_RAW("payload", payload, strlen(payload)),
+		    SLOG_FIELD_TRUSTED("id", "abc"));
+	assert_contains(captured, "\"request\":\"GET\",\"payload\":{\"ids\":"
+				  "[1,2],\"ok\":true},\"id\":\"abc\"}");
+
+	// loggers copy the bytes, not the caller's buffer
+	char name[] = "first-second";
+	struct slog_logger *logger =
+		SLOG_LOGGER(NULL, SLOG_STRING_N("name", name, 5),
+			    SLOG_RAW("tags", "[1]", 3));
+	memset(name, 'x', sizeof(name) - 1);
+	SLOG_WITH(logger, SLOG_INFO, "bound");
+	assert_contains(captured, "\"name\":\"first\",\"tags\":[1]}");
+	SLOG_LOGGER_FREE(logger);
+}
+
+// Nested far deeper than recursion on the C stack would survive.
+#define DEEP 200000
+
+static struct slog_node *deep_array(const char *key) {
+	struct slog_node *root = NULL;
+	struct slog_node *node;
+	int nodes = 0;
+	for (; nodes < DEEP && (node = slog_node_get()); nodes++) {
+		node->type = nodes ? SLOG_TYPE_ARRAY : SLOG_TYPE_INT;
+		node->value.array = root;
+		root = node;
+	}
+	CU_ASSERT_EQUAL(nodes, DEEP);
+	root->key = key;
+	return root;
+}
+
+static size_t written = 0;
+
+static void length_writer(const struct slog_record *record) {
+	written = record->len;
+}
+
+void test_json_deep_nesting(void) {
+	slog_buffer.index = 0;
+	slog_write_node(deep_array(NULL));
+	const char *text = slog_buffer_flush_and_reset();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(text);
+	CU_ASSERT_EQUAL(strlen(text), (size_t)(DEEP - 1) * 2 + 1);
+	CU_ASSERT_EQUAL(text[DEEP - 2], '[');
+	CU_ASSERT_EQUAL(text[DEEP - 1], '0');
+	CU_ASSERT_EQUAL(text[DEEP], ']');
+
+	// every encoding and binary records walk nodes the same way
+	SLOG_SET_WRITER(length_writer, false);
+	const enum slog_encoding encodings[] = {
+		SLOG_ENCODING_JSON, SLOG_ENCODING_LOGFMT, SLOG_ENCODING_CBOR,
+		SLOG_ENCODING_MSGPACK};
+	for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]);
+	     i++) {
+		SLOG_SET_ENCODING(encodings[i]);
+		written = 0;
+		SLOG(SLOG_INFO, "deep", deep_array("a"));
+		CU_ASSERT(written > 30);
+	}
+	SLOG_SET_ENCODING(SLOG_ENCODING_JSON);
+
+	char path[] = "/tmp/slog-deep-XXXXXX";
+	const int fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	SLOG_BINARY_START(fd);
+	SLOG(SLOG_INFO, "deep", deep_array("a"));
+	SLOG_FLUSH();
+	SLOG_BINARY_STOP();
+	CU_ASSERT(lseek(fd, 0, SEEK_END) > DEEP * 2);
+	close(fd);
+	unlink(path);
+	SLOG_SET_HANDLER(capture_handler);
+
+	// long strings are measured exactly rather than at six times their size
+	char payload[1000];
+	for (size_t i = 0; i < sizeof(payload) - 1; i++) {
+		payload[i] = i % 100 == 7 ? '"' : i % 100 == 50 ? '\n' : 'x';
+	}
+	payload[sizeof(payload) - 1] = '\0';
+	slog_write_escape(payload);
+	char *expected = strdup(slog_buffer_flush_and_reset());
+	CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+	slog_write_node(SLOG_ARRAY(NULL, SLOG_STRING(NULL, payload),
+				   SLOG_STRING(NULL, "")));
+	text = slog_buffer_flush_and_reset();
+	CU_ASSERT_EQUAL(text[0], '[');
+	CU_ASSERT_NSTRING_EQUAL(text + 1, expected, strlen(expected));
+	CU_ASSERT_STRING_EQUAL(text + 1 + strlen(expected), ",\"\"]");
+	free(expected);
+}
+
 int main(void) {
 	CU_initialize_registry();
 
 	CU_pSuite suite_json = CU_add_suite("json", NULL, suite_cleanup);
 	CU_add_test(suite_json, "json format", test_json_format);
 	CU_add_test(suite_json, "json escape", test_json_escape);
+	CU_add_test(suite_json, "json escape long", test_json_escape_long);
+	CU_add_test(suite_json, "json numbers", test_json_numbers);
+	CU_add_test(suite_json, "json float round trip",
+		    test_json_float_round_trip);
+	CU_add_test(suite_json, "json slices and raw",
+		    test_json_slices_and_raw);
+	CU_add_test(suite_json, "json cached fragments",
+		    test_json_cached_fragments);
+	CU_add_test(suite_json, "json deep nesting", test_json_deep_nesting);
 
 	CU_basic_run_tests();
 	CU_cleanup_registry();
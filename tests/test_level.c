@@ -1,3 +1,5 @@
+#define SLOG_MIN_LEVEL SLOG_INFO
+#define SLOG_MODULE "levels"
 #include "slog.h"
 #include <CUnit/Basic.h>
 #include <CUnit/CUnit.h>
@@ -10,6 +12,7 @@ static void capture_handler(const char *str) {
 }
 
 static int suite_cleanup(void) {
+	SLOG_RESET();
 	SLOG_FREE();
 	handler_calls = 0;
 	return 0;
@@ -31,11 +34,94 @@ void test_level_filtering(void) {
 	CU_ASSERT_EQUAL(handler_calls, 2);
 }
 
+static int evaluated = 0;
+
+static int side_effect(void) {
+	return ++evaluated;
+}
+
+void test_level_compiled_out(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_DEBUG);
+
+	handler_calls = 0;
+	SLOG(SLOG_DEBUG, "below SLOG_MIN_LEVEL", SLOG_INT("n", side_effect()));
+	CU_ASSERT_EQUAL(handler_calls, 0);
+	CU_ASSERT_EQUAL(evaluated, 0);
+
+	SLOG(SLOG_INFO, "at SLOG_MIN_LEVEL", SLOG_INT("n", side_effect()));
+	CU_ASSERT_EQUAL(handler_calls, 1);
+	CU_ASSERT_EQUAL(evaluated, 1);
+}
+
+static void *log_info(void *arg) {
+	(void)arg;
+	SLOG(SLOG_INFO, "from another thread");
+	SLOG_FREE();
+	return NULL;
+}
+
+static void log_info_here(void) {
+	SLOG(SLOG_INFO, "module override");
+}
+
+void test_level_process_wide(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_WARN);
+	handler_calls = 0;
+
+	// a new thread sees the handler and level set here
+	pthread_t thread;
+	pthread_create(&thread, NULL, log_info, NULL);
+	pthread_join(thread, NULL);
+	CU_ASSERT_EQUAL(handler_calls, 0);
+
+	SLOG_SET_LEVEL(SLOG_INFO);
+	pthread_create(&thread, NULL, log_info, NULL);
+	pthread_join(thread, NULL);
+	CU_ASSERT_EQUAL(handler_calls, 1);
+}
+
+void test_level_module_overrides(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_INFO);
+	handler_calls = 0;
+
+	log_info_here();
+	CU_ASSERT_EQUAL(handler_calls, 1);
+
+	// the file name, a directory and SLOG_MODULE all name this callsite
+	CU_ASSERT_TRUE(SLOG_SET_LEVELS("test_level=warn,*=debug"));
+	log_info_here();
+	CU_ASSERT_EQUAL(handler_calls, 1);
+	SLOG_RESET();
+	SLOG_SET_HANDLER(capture_handler);
+
+	CU_ASSERT_TRUE(SLOG_SET_MODULE_LEVEL("*", SLOG_ERROR));
+	log_info_here();
+	CU_ASSERT_EQUAL(handler_calls, 1);
+	CU_ASSERT_TRUE(SLOG_SET_MODULE_LEVEL("levels", SLOG_INFO));
+	log_info_here();
+	CU_ASSERT_EQUAL(handler_calls, 2);
+	CU_ASSERT_TRUE(SLOG_SET_LEVELS("levels=WARN"));
+	log_info_here();
+	CU_ASSERT_EQUAL(handler_calls, 2);
+
+	CU_ASSERT_FALSE(SLOG_SET_LEVELS("levels=info,net"));
+	CU_ASSERT_FALSE(SLOG_SET_LEVELS("levels=loud"));
+	log_info_here();
+	CU_ASSERT_EQUAL(handler_calls, 2);
+}
+
 int main(void) {
 	CU_initialize_registry();
 
 	CU_pSuite suite_level = CU_add_suite("level", NULL, suite_cleanup);
 	CU_add_test(suite_level, "level filtering", test_level_filtering);
+	CU_add_test(suite_level, "level compiled out", test_level_compiled_out);
+	CU_add_test(suite_level, "process wide", test_level_process_wide);
+	CU_add_test(suite_level, "module overrides",
+		    test_level_module_overrides);
 
 	CU_basic_run_tests();
 	CU_cleanup_registry();
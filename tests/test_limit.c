@@ -0,0 +1,71 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *captured = NULL;
+static int handler_calls = 0;
+
+static void capture_handler(const char *str) {
+	handler_calls++;
+	free(captured);
+	captured = strdup(str);
+}
+
+static int suite_cleanup(void) {
+	SLOG_FREE();
+	free(captured);
+	captured = NULL;
+	handler_calls = 0;
+	return 0;
+}
+
+void test_limit_sampled(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	handler_calls = 0;
+	int evaluated = 0;
+	for (int i = 0; i < 100; i++) {
+		SLOG_SAMPLED(SLOG_WARN, 10, "sampled",
+			     SLOG_INT("i", (evaluated++, i)));
+		if (i == 0) {
+			CU_ASSERT_PTR_NOT_NULL(
+				strstr(captured, "\"i\":0,\"suppressed\":0}"));
+		}
+	}
+	// rejected calls never evaluate their fields
+	CU_ASSERT_EQUAL(handler_calls, 10);
+	CU_ASSERT_EQUAL(evaluated, 10);
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"i\":90,\"suppressed\":9}"));
+}
+
+static void log_limited(int i) {
+	SLOG_RATELIMIT(SLOG_WARN, 100, 3, "limited", SLOG_INT("i", i));
+}
+
+void test_limit_ratelimit(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	handler_calls = 0;
+	for (int i = 0; i < 50; i++) {
+		log_limited(i);
+	}
+	CU_ASSERT_EQUAL(handler_calls, 3);
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"i\":2,\"suppressed\":0}"));
+
+	// one interval later a single record is let through again
+	usleep(30000);
+	log_limited(50);
+	CU_ASSERT_EQUAL(handler_calls, 4);
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"i\":50,\"suppressed\":47}"));
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_limit = CU_add_suite("limit", NULL, suite_cleanup);
+	CU_add_test(suite_limit, "sampled", test_limit_sampled);
+	CU_add_test(suite_limit, "ratelimit", test_limit_ratelimit);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,114 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *captured = NULL;
+
+static void capture_handler(const char *str) {
+	free(captured);
+	captured = strdup(str);
+}
+
+static int suite_cleanup(void) {
+	SLOG_RESET();
+	SLOG_FREE();
+	free(captured);
+	captured = NULL;
+	return 0;
+}
+
+// from "msg" on; the callsite and time differ between the two forms
+static char *record_tail(void) {
+	const char *msg = captured ? strstr(captured, "\"msg\":") : NULL;
+	return strdup(msg ? msg : "");
+}
+
+static struct slog_logger *make_child(void) {
+	char tenant[] = "acme \"corp\"";
+	struct slog_logger *parent =
+		SLOG_LOGGER(NULL, SLOG_STRING("request_id", "r-1"),
+			    SLOG_STRING("tenant", tenant));
+	struct slog_logger *child = SLOG_LOGGER(
+		parent, SLOG_INT("shard", 7),
+		SLOG_OBJECT("trace", SLOG_STRING("id", "t-9"),
+			    SLOG_ARRAY("spans", SLOG_INT(NULL, 1),
+				       SLOG_INT(NULL, 2))));
+	// the child owns copies of everything it needs
+	memset(tenant, 'x', sizeof(tenant) - 1);
+	SLOG_LOGGER_FREE(parent);
+	return child;
+}
+
+static void log_child(const struct slog_logger *child, int i) {
+	SLOG_WITH(child, SLOG_INFO, "bound", SLOG_INT("i", i));
+}
+
+void test_logger_bound_fields(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	struct slog_logger *child = make_child();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(child);
+
+	log_child(child, 1);
+	char *bound = record_tail();
+	SLOG(SLOG_INFO, "bound", SLOG_STRING("request_id", "r-1"),
+	     SLOG_STRING("tenant", "acme \"corp\""), SLOG_INT("shard", 7),
+	     SLOG_OBJECT("trace", SLOG_STRING("id", "t-9"),
+			 SLOG_ARRAY("spans", SLOG_INT(NULL, 1),
+				    SLOG_INT(NULL, 2))),
+	     SLOG_INT("i", 1));
+	char *inline_fields = record_tail();
+	CU_ASSERT_STRING_EQUAL(bound, inline_fields);
+	free(bound);
+	free(inline_fields);
+
+	struct slog_logger *empty = SLOG_LOGGER(NULL);
+	SLOG_WITH(empty, SLOG_INFO, "no fields");
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"msg\":\"no fields\"}"));
+	SLOG_LOGGER_FREE(empty);
+	SLOG_LOGGER_FREE(child);
+}
+
+void test_logger_binary(void) {
+	const char *decoder = getenv("SLOG_DECODE");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoder);
+	char path[] = "/tmp/slog-logger-XXXXXX";
+	int fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+
+	struct slog_logger *child = make_child();
+	SLOG_BINARY_START(fd);
+	log_child(child, 2);
+	SLOG_BINARY_STOP();
+	close(fd);
+
+	char command[256];
+	snprintf(command, sizeof(command), "%s %s", decoder, path);
+	FILE *decoded = popen(command, "r");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+	char line[1024] = "";
+	CU_ASSERT_PTR_NOT_NULL(fgets(line, sizeof(line), decoded));
+	line[strcspn(line, "\n")] = '\0';
+	CU_ASSERT_EQUAL(pclose(decoded), 0);
+	unlink(path);
+
+	SLOG_SET_HANDLER(capture_handler);
+	log_child(child, 2);
+	char *text = record_tail();
+	CU_ASSERT_STRING_EQUAL(strstr(line, "\"msg\":"), text);
+	free(text);
+	SLOG_LOGGER_FREE(child);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_logger = CU_add_suite("logger", NULL, suite_cleanup);
+	CU_add_test(suite_logger, "bound fields", test_logger_bound_fields);
+	CU_add_test(suite_logger, "binary", test_logger_binary);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,103 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void null_handler(const char *str) {
+	(void)str;
+}
+
+static int suite_cleanup(void) {
+	SLOG_RESET();
+	SLOG_FREE();
+	return 0;
+}
+
+static void log_ten_fields(void) {
+	SLOG(SLOG_INFO, "ten", SLOG_INT("a", 1), SLOG_INT("b", 2),
+	     SLOG_INT("c", 3), SLOG_INT("d", 4), SLOG_INT("e", 5),
+	     SLOG_INT("f", 6), SLOG_INT("g", 7), SLOG_INT("h", 8),
+	     SLOG_INT("i", 9), SLOG_INT("j", 10));
+}
+
+void test_memory_pool_cap(void) {
+	SLOG_SET_HANDLER(null_handler);
+	struct slog_memory_config config = {4, SIZE_MAX};
+	SLOG_SET_MEMORY(&config);
+
+	struct slog_memory_stats before, after;
+	SLOG_MEMORY_STATS(&before);
+	log_ten_fields();
+	log_ten_fields();
+	SLOG_MEMORY_STATS(&after);
+	CU_ASSERT_EQUAL(after.pooled_nodes, 4);
+	CU_ASSERT_EQUAL(after.pool_released - before.pool_released, 12);
+	CU_ASSERT_EQUAL(after.pool_hits - before.pool_hits, 4);
+	CU_ASSERT_EQUAL(after.pool_misses - before.pool_misses, 16);
+	CU_ASSERT_EQUAL(after.threads, 1);
+
+	SLOG_FREE();
+	SLOG_MEMORY_STATS(&after);
+	CU_ASSERT_EQUAL(after.pooled_nodes, 0);
+	CU_ASSERT_EQUAL(after.threads, 0);
+}
+
+void test_memory_buffer_shrinks(void) {
+	SLOG_SET_HANDLER(null_handler);
+	struct slog_memory_config config = {SIZE_MAX, 16 * 1024};
+	SLOG_SET_MEMORY(&config);
+
+	const size_t spike = 256 * 1024;
+	char *big = (char *)malloc(spike + 1);
+	memset(big, 'x', spike);
+	big[spike] = '\0';
+	SLOG(SLOG_INFO, "spike", SLOG_STRING("big", big));
+	free(big);
+
+	struct slog_memory_stats stats;
+	SLOG_MEMORY_STATS(&stats);
+	CU_ASSERT(stats.buffer_bytes > spike);
+	CU_ASSERT(stats.buffer_high_water > spike);
+
+	SLOG(SLOG_INFO, "small again");
+	SLOG_MEMORY_STATS(&stats);
+	CU_ASSERT_EQUAL(stats.buffer_bytes, 16 * 1024);
+	CU_ASSERT(stats.buffer_high_water > spike);
+	SLOG_FREE();
+}
+
+static void *exit_without_free(void *arg) {
+	(void)arg;
+	log_ten_fields();
+	return NULL;
+}
+
+void test_memory_released_on_thread_exit(void) {
+	SLOG_SET_HANDLER(null_handler);
+	struct slog_memory_stats before, after;
+	SLOG_MEMORY_STATS(&before);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, exit_without_free, NULL);
+	pthread_join(thread, NULL);
+
+	SLOG_MEMORY_STATS(&after);
+	CU_ASSERT_EQUAL(after.threads, before.threads);
+	CU_ASSERT_EQUAL(after.pooled_nodes, before.pooled_nodes);
+	CU_ASSERT_EQUAL(after.buffer_bytes, before.buffer_bytes);
+	CU_ASSERT_EQUAL(after.pool_misses - before.pool_misses, 10);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_memory = CU_add_suite("memory", NULL, suite_cleanup);
+	CU_add_test(suite_memory, "pool cap", test_memory_pool_cap);
+	CU_add_test(suite_memory, "buffer shrinks", test_memory_buffer_shrinks);
+	CU_add_test(suite_memory, "released on thread exit",
+		    test_memory_released_on_thread_exit);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,123 @@
+#include "slog_ring.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define RING_SIZE 16384
+
+static char path[] = "/tmp/slog_ring_XXXXXX";
+
+static int suite_init(void) {
+	const int fd = mkstemp(path);
+	if (fd < 0) {
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static int suite_cleanup(void) {
+	SLOG_FREE();
+	unlink(path);
+	return 0;
+}
+
+struct replay {
+	int count;
+	long first;
+	long last;
+	bool ordered;
+};
+
+static void check_record(const char *record, size_t len, void *arg) {
+	struct replay *r = (struct replay *)arg;
+	const char *key = strstr(record, "\"i\":");
+	CU_ASSERT_EQUAL(record[len - 1], '}');
+	if (!key) {
+		r->ordered = false;
+		return;
+	}
+	const long i = strtol(key + 4, NULL, 10);
+	if (r->count && i != r->last + 1) {
+		r->ordered = false;
+	}
+	if (!r->count) {
+		r->first = i;
+	}
+	r->last = i;
+	r->count++;
+}
+
+static long replay_file(struct replay *r) {
+	memset(r, 0, sizeof(*r));
+	r->ordered = true;
+	struct slog_ring *ring = slog_ring_open(path, RING_SIZE);
+	if (!ring) {
+		return -1;
+	}
+	const long n = slog_ring_replay(ring->header, ring->map_size,
+					check_record, r);
+	slog_ring_close(ring);
+	return n;
+}
+
+void test_ring_survives_sigkill(void) {
+	const pid_t pid = fork();
+	CU_ASSERT_FATAL(pid >= 0);
+	if (pid == 0) {
+		struct slog_ring *ring = slog_ring_open(path, RING_SIZE);
+		if (!ring) {
+			_exit(1);
+		}
+		SLOG_SET_RING(ring);
+		for (int i = 0; i < 1000; i++) {
+			SLOG(SLOG_INFO, "before crash", SLOG_INT("i", i));
+		}
+		raise(SIGKILL);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	CU_ASSERT_TRUE(WIFSIGNALED(status));
+
+	// the ring holds only the newest records, oldest first
+	struct replay r;
+	const long n = replay_file(&r);
+	CU_ASSERT_EQUAL(n, r.count);
+	CU_ASSERT(r.count > 10);
+	CU_ASSERT(r.count < 1000);
+	CU_ASSERT_TRUE(r.ordered);
+	CU_ASSERT_EQUAL(r.last, 999);
+	CU_ASSERT_EQUAL(r.first, 1000 - r.count);
+}
+
+void test_ring_reopen_appends(void) {
+	struct slog_ring *ring = slog_ring_open(path, RING_SIZE);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(ring);
+	SLOG_SET_RING(ring);
+	SLOG(SLOG_INFO, "after restart", SLOG_INT("i", 1000));
+
+	char big[RING_SIZE];
+	memset(big, 'x', sizeof(big));
+	CU_ASSERT_FALSE(slog_ring_write(ring, big, sizeof(big)));
+	CU_ASSERT_EQUAL(ring->dropped, 1);
+	slog_ring_close(ring);
+
+	struct replay r;
+	replay_file(&r);
+	CU_ASSERT_TRUE(r.ordered);
+	CU_ASSERT_EQUAL(r.last, 1000);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite_ring = CU_add_suite("ring", suite_init, suite_cleanup);
+	CU_add_test(suite_ring, "survives SIGKILL", test_ring_survives_sigkill);
+	CU_add_test(suite_ring, "reopen appends", test_ring_reopen_appends);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
@@ -0,0 +1,234 @@
+#include "slog_file.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINES 8
+
+struct capture {
+	char *lines[MAX_LINES];
+	const char *data[MAX_LINES]; // buffer each record was handed in
+	int count;
+};
+
+static struct capture errors, debug, all;
+
+static void capture_sink(const struct slog_record *record, void *arg) {
+	struct capture *c = arg;
+	if (c->count < MAX_LINES) {
+		c->lines[c->count] = strndup(record->data, record->len);
+		c->data[c->count] = record->data;
+	}
+	c->count++;
+}
+
+static void clear(struct capture *c) {
+	for (int i = 0; i < c->count && i < MAX_LINES; i++) {
+		free(c->lines[i]);
+	}
+	memset(c, 0, sizeof(*c));
+}
+
+static int suite_cleanup(void) {
+	SLOG_RESET();
+	SLOG_FREE();
+	clear(&errors);
+	clear(&debug);
+	clear(&all);
+	return 0;
+}
+
+static int evaluated = 0;
+
+static int count_evaluation(void) {
+	return ++evaluated;
+}
+
+static void add_sink(struct capture *c, enum slog_level level,
+		     enum slog_encoding encoding) {
+	struct slog_sink_config config = {capture_sink, c, level, encoding};
+	CU_ASSERT(SLOG_SINK_ADD(&config) >= 0);
+}
+
+void test_sink_fan_out(void) {
+	add_sink(&errors, SLOG_ERROR, SLOG_ENCODING_JSON);
+	add_sink(&debug, SLOG_DEBUG, SLOG_ENCODING_LOGFMT);
+	add_sink(&all, SLOG_DEBUG, SLOG_ENCODING_JSON);
+
+	SLOG(SLOG_ERROR, "disk full", SLOG_INT("free", 0));
+	SLOG(SLOG_DEBUG, "cache miss", SLOG_STRING("key", "a"));
+	CU_ASSERT_EQUAL_FATAL(errors.count, 1);
+	CU_ASSERT_EQUAL_FATAL(debug.count, 2);
+	CU_ASSERT_EQUAL_FATAL(all.count, 2);
+
+	// sinks of one encoding share the buffer of a single serialization
+	CU_ASSERT_PTR_EQUAL(errors.data[0], all.data[0]);
+	CU_ASSERT_STRING_EQUAL(errors.lines[0], all.lines[0]);
+	CU_ASSERT_PTR_NOT_NULL(
+		strstr(errors.lines[0], "\"msg\":\"disk full\",\"free\":0}"));
+	CU_ASSERT_PTR_NOT_NULL(strstr(debug.lines[0], "msg=\"disk full\""));
+	CU_ASSERT_PTR_NOT_NULL(strstr(debug.lines[1], "key=a"));
+	CU_ASSERT_PTR_NOT_NULL(strstr(all.lines[1], "\"key\":\"a\"}"));
+}
+
+void test_sink_levels(void) {
+	SLOG_RESET();
+	clear(&errors);
+	clear(&debug);
+	add_sink(&errors, SLOG_ERROR, SLOG_ENCODING_JSON);
+	const int warn = SLOG_SINK_ADD(&(struct slog_sink_config){
+		capture_sink, &debug, SLOG_WARN, SLOG_ENCODING_JSON});
+	CU_ASSERT_FATAL(warn >= 0);
+
+	// nothing takes debug records, so their arguments are not evaluated
+	evaluated = 0;
+	SLOG(SLOG_DEBUG, "skipped", SLOG_INT("n", count_evaluation()));
+	SLOG(SLOG_WARN, "slow", SLOG_INT("n", count_evaluation()));
+	CU_ASSERT_EQUAL(evaluated, 1);
+	CU_ASSERT_EQUAL(errors.count, 0);
+	CU_ASSERT_EQUAL(debug.count, 1);
+
+	// the queue keeps each record's sinks
+	struct slog_async_config config = {0};
+	config.capacity = 16;
+	CU_ASSERT_FATAL(SLOG_ASYNC_START(&config));
+	SLOG(SLOG_ERROR, "queued");
+	SLOG_FLUSH();
+	SLOG_ASYNC_STOP();
+	CU_ASSERT_EQUAL(errors.count, 1);
+	CU_ASSERT_EQUAL(debug.count, 2);
+
+	SLOG_SINK_REMOVE(warn);
+	SLOG(SLOG_WARN, "dropped", SLOG_INT("n", count_evaluation()));
+	CU_ASSERT_EQUAL(evaluated, 1);
+	CU_ASSERT_EQUAL(debug.count, 2);
+}
+
+static void reuse(int id, struct capture *c, enum slog_level level,
+		 enum slog_encoding encoding) {
+	SLOG_SINK_REMOVE(id);
+	CU_ASSERT_EQUAL(SLOG_SINK_ADD(&(struct slog_sink_config){
+				capture_sink, c, level, encoding}),
+			id);
+}
+
+void test_sink_slot_reuse(void) {
+	SLOG_RESET();
+	clear(&errors);
+	clear(&debug);
+	clear(&all);
+	const int id = SLOG_SINK_ADD(&(struct slog_sink_config){
+		capture_sink, &errors, SLOG_DEBUG, SLOG_ENCODING_JSON});
+	CU_ASSERT_FATAL(id >= 0);
+
+	// a JSON info record still in flight when the slot is given to
+	// sinks that would not have taken it
+	char json[] = "{}";
+	const struct slog_record record = {json, 2, 3, SLOG_INFO, {0, 0},
+					   SLOG_ENCODING_JSON};
+	reuse(id, &debug, SLOG_DEBUG, SLOG_ENCODING_LOGFMT);
+	slog_sinks_write(&record, 1u << id, SLOG_ENCODING_JSON);
+	reuse(id, &all, SLOG_WARN, SLOG_ENCODING_JSON);
+	slog_sinks_write(&record, 1u << id, SLOG_ENCODING_JSON);
+	CU_ASSERT_EQUAL(errors.count, 0);
+	CU_ASSERT_EQUAL(debug.count, 0);
+	CU_ASSERT_EQUAL(all.count, 0);
+
+	// one that would have is fine
+	reuse(id, &debug, SLOG_INFO, SLOG_ENCODING_JSON);
+	slog_sinks_write(&record, 1u << id, SLOG_ENCODING_JSON);
+	CU_ASSERT_EQUAL(debug.count, 1);
+}
+
+// Returns the end of the CBOR item at p, or NULL when it is malformed.
+static const unsigned char *cbor_skip(const unsigned char *p,
+				      const unsigned char *end) {
+	if (p >= end) {
+		return NULL;
+	}
+	const unsigned major = *p >> 5;
+	const unsigned info = *p++ & 0x1f;
+	uint64_t v = info;
+	if (info >= 24 && info <= 27) {
+		const int n = 1 << (info - 24);
+		if (end - p < n) {
+			return NULL;
+		}
+		v = 0;
+		for (int i = 0; i < n; i++) {
+			v = v << 8 | *p++;
+		}
+	} else if (info > 27) {
+		return NULL;
+	}
+	switch (major) {
+	case 2:
+	case 3:
+		return (uint64_t)(end - p) < v ? NULL : p + v;
+	case 4:
+	case 5:
+		for (uint64_t i = 0; p && i < (major == 5 ? 2 * v : v); i++) {
+			p = cbor_skip(p, end);
+		}
+		return p;
+	case 6:
+		return cbor_skip(p, end);
+	default:
+		return p;
+	}
+}
+
+void test_sink_binary_file(void) {
+	SLOG_RESET();
+	char path[] = "/tmp/slog-sink-XXXXXX";
+	const int fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	close(fd);
+	struct slog_file_config file = {.path = path};
+	struct slog_file *f = slog_file_open(&file);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(f);
+	const int id = SLOG_SINK_ADD(&(struct slog_sink_config){
+		slog_file_sink, f, SLOG_DEBUG, SLOG_ENCODING_CBOR});
+	CU_ASSERT_FATAL(id >= 0);
+
+	// 10 is also '\n', which a line-oriented sink would cut at
+	for (int i = 0; i < 3; i++) {
+		SLOG(SLOG_INFO, "binary", SLOG_INT("n", 10),
+		     SLOG_ARRAY("list", SLOG_INT(NULL, i)));
+	}
+	slog_file_flush(f);
+	SLOG_SINK_REMOVE(id);
+	slog_file_close(f);
+
+	unsigned char data[4096];
+	FILE *in = fopen(path, "rb");
+	CU_ASSERT_PTR_NOT_NULL_FATAL(in);
+	const size_t len = fread(data, 1, sizeof(data), in);
+	fclose(in);
+	unlink(path);
+
+	// nothing but the three maps
+	const unsigned char *p = data;
+	int records = 0;
+	while (p && p < data + len) {
+		CU_ASSERT_EQUAL(*p >> 5, 5);
+		p = cbor_skip(p, data + len);
+		records++;
+	}
+	CU_ASSERT_PTR_EQUAL(p, data + len);
+	CU_ASSERT_EQUAL(records, 3);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("sink", NULL, suite_cleanup);
+	CU_add_test(suite, "sink fan out", test_sink_fan_out);
+	CU_add_test(suite, "sink levels", test_sink_levels);
+	CU_add_test(suite, "sink slot reuse", test_sink_slot_reuse);
+	CU_add_test(suite, "sink binary file", test_sink_binary_file);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
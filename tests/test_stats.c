@@ -0,0 +1,103 @@
+#include "slog.h"
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *captured = NULL;
+static int reports = 0;
+static size_t total_bytes = 0;
+
+static void capture_handler(const char *str) {
+	total_bytes += strlen(str);
+	if (strstr(str, "\"msg\":\"slog stats\"")) {
+		reports++;
+		free(captured);
+		captured = strdup(str);
+	}
+}
+
+static int suite_cleanup(void) {
+	SLOG_STATS_REPORT(0);
+	SLOG_RESET();
+	SLOG_FREE();
+	free(captured);
+	captured = NULL;
+	return 0;
+}
+
+static unsigned long long handler_samples(const struct slog_stats *s) {
+	unsigned long long samples = 0;
+	for (int i = 0; i < SLOG_STATS_BUCKETS; i++) {
+		samples += s->handler_ns[i];
+	}
+	return samples;
+}
+
+void test_stats_counters(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_INFO);
+
+	struct slog_stats before, after;
+	SLOG_STATS(&before);
+	total_bytes = 0;
+	for (int i = 0; i < 10 * SLOG_STATS_SAMPLE; i++) {
+		SLOG(SLOG_WARN, "counted", SLOG_INT("i", i));
+		SLOG(SLOG_DEBUG, "filtered", SLOG_INT("i", i));
+	}
+	SLOG_FIELDS(SLOG_ERROR, "fields");
+	SLOG(SLOG_INFO, "info");
+	SLOG_STATS(&after);
+
+	CU_ASSERT_EQUAL(after.records[SLOG_WARN] - before.records[SLOG_WARN],
+			10 * SLOG_STATS_SAMPLE);
+	CU_ASSERT_EQUAL(after.records[SLOG_ERROR] - before.records[SLOG_ERROR],
+			1);
+	CU_ASSERT_EQUAL(after.records[SLOG_INFO] - before.records[SLOG_INFO],
+			1);
+	CU_ASSERT_EQUAL(after.filtered[SLOG_DEBUG] -
+				before.filtered[SLOG_DEBUG],
+			10 * SLOG_STATS_SAMPLE);
+	CU_ASSERT_EQUAL(after.bytes - before.bytes, total_bytes);
+	CU_ASSERT(after.reallocs >= 1);
+	CU_ASSERT(after.pool_misses >= 1);
+	const unsigned long long samples =
+		handler_samples(&after) - handler_samples(&before);
+	CU_ASSERT(samples >= 10 && samples <= 11);
+}
+
+void test_stats_self_report(void) {
+	SLOG_SET_HANDLER(capture_handler);
+	SLOG_SET_LEVEL(SLOG_DEBUG);
+	reports = 0;
+
+	SLOG_STATS_REPORT(1);
+	SLOG(SLOG_INFO, "too early");
+	CU_ASSERT_EQUAL(reports, 0);
+
+	struct timespec pause = {1, 100 * 1000 * 1000};
+	nanosleep(&pause, NULL);
+	SLOG(SLOG_INFO, "due");
+	SLOG(SLOG_INFO, "not due again");
+	CU_ASSERT_EQUAL(reports, 1);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(captured);
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"records\":{\"error\":"));
+	CU_ASSERT_PTR_NOT_NULL(strstr(captured, "\"handler_p99_ns\":"));
+
+	// the report is filtered like any record of the "slog" module
+	SLOG_SET_MODULE_LEVEL("slog", SLOG_WARN);
+	nanosleep(&pause, NULL);
+	SLOG(SLOG_INFO, "due");
+	CU_ASSERT_EQUAL(reports, 1);
+}
+
+int main(void) {
+	CU_initialize_registry();
+
+	CU_pSuite suite = CU_add_suite("stats", NULL, suite_cleanup);
+	CU_add_test(suite, "stats counters", test_stats_counters);
+	CU_add_test(suite, "stats self report", test_stats_self_report);
+
+	CU_basic_run_tests();
+	CU_cleanup_registry();
+}
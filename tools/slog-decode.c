@@ -0,0 +1,394 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+// Converts the binary stream written after SLOG_BINARY_START into the JSON
+// lines slog would have printed, one record per line.
+//
+//   slog-decode [FILE]    reads stdin when FILE is omitted
+
+#include "slog.h"
+
+struct decode_def {
+	char *str; // string definitions
+	size_t len;
+	int line; // callsite definitions
+	char *file;
+	char *func;
+	char *level;
+};
+
+struct decode_stream {
+	uint32_t id;
+	struct decode_def *defs;
+	size_t count;
+};
+
+struct decode_cursor {
+	const unsigned char *p;
+	const unsigned char *end;
+	bool bad;
+};
+
+static struct decode_stream *streams = NULL;
+static size_t stream_count = 0;
+
+static struct decode_stream *stream_get(uint32_t id) {
+	for (size_t i = 0; i < stream_count; i++) {
+		if (streams[i].id == id) {
+			return &streams[i];
+		}
+	}
+	struct decode_stream *grown = (struct decode_stream *)realloc(
+		streams, (stream_count + 1) * sizeof(*streams));
+	if (!grown) {
+		return NULL;
+	}
+	streams = grown;
+	struct decode_stream *s = &streams[stream_count++];
+	memset(s, 0, sizeof(*s));
+	s->id = id;
+	return s;
+}
+
+static struct decode_def *def_get(struct decode_stream *s, uint64_t id) {
+	return id < s->count ? &s->defs[id] : NULL;
+}
+
+// Ids are handed out in order and every definition takes a few bytes, so
+// one further ahead than the rest of the chunk is corrupt rather than a
+// reason to grow the table.
+static struct decode_def *def_new(struct decode_stream *s, uint64_t id,
+				  const struct decode_cursor *c) {
+	if (id >= s->count) {
+		if (id - s->count >= (uint64_t)(c->end - c->p)) {
+			return NULL;
+		}
+		const size_t count = (size_t)id + 1;
+		struct decode_def *grown = (struct decode_def *)realloc(
+			s->defs, count * sizeof(*s->defs));
+		if (!grown) {
+			return NULL;
+		}
+		memset(grown + s->count, 0, (count - s->count) * sizeof(*grown));
+		s->defs = grown;
+		s->count = count;
+	}
+	return &s->defs[id];
+}
+
+static uint64_t read_varint(struct decode_cursor *c) {
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (c->p >= c->end) {
+			break;
+		}
+		const unsigned char b = *c->p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return v;
+		}
+	}
+	c->bad = true;
+	return 0;
+}
+
+static const char *read_string(struct decode_cursor *c, size_t *len) {
+	*len = (size_t)read_varint(c);
+	if (c->bad || (size_t)(c->end - c->p) < *len) {
+		c->bad = true;
+		return NULL;
+	}
+	const char *str = (const char *)c->p;
+	c->p += *len;
+	return str;
+}
+
+static char *dup_string(struct decode_cursor *c) {
+	size_t len;
+	const char *str = read_string(c, &len);
+	if (!str) {
+		return NULL;
+	}
+	char *copy = (char *)malloc(len + 1);
+	if (copy) {
+		memcpy(copy, str, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+static void write_key(const char *key) {
+	slog_write_escape(key);
+	slog_buffer_putc(':');
+}
+
+// Arrays and objects nested deeper than this are rejected.
+#define DECODE_DEPTH 1024
+
+static void decode_fields(struct decode_stream *s, struct decode_cursor *c,
+			  int depth) {
+	bool first = true;
+	while (!c->bad && c->p < c->end) {
+		const unsigned char type = *c->p++;
+		if (!type) {
+			return;
+		}
+		if (!first) {
+			slog_buffer_putc(',');
+		}
+		first = false;
+
+		const uint64_t key = read_varint(c);
+		if (key == 1) {
+			c->bad = true;
+			return;
+		}
+		if (key) {
+			const uint64_t id = key / 2 - 1;
+			struct decode_def *def =
+				key & 1 ? def_new(s, id, c) : def_get(s, id);
+			if (def && (key & 1)) {
+				free(def->str);
+				def->str = dup_string(c);
+				def->len = def->str ? strlen(def->str) : 0;
+			}
+			if (!def || !def->str) {
+				c->bad = true;
+				return;
+			}
+			slog_write_escape_n(def->str, def->len);
+			slog_buffer_putc(':');
+		}
+
+		switch (type) {
+		case SLOG_TYPE_STRING: {
+			size_t len;
+			const char *str = read_string(c, &len);
+			if (str) {
+				slog_write_escape_n(str, len);
+			}
+			break;
+		}
+		case SLOG_TYPE_RAW: {
+			size_t len;
+			const char *str = read_string(c, &len);
+			if (str) {
+				slog_buffer_append(str, len);
+			}
+			break;
+		}
+		case SLOG_TYPE_INT: {
+			const uint64_t z = read_varint(c);
+			slog_write_int((long long)(z >> 1) ^ -(long long)(z & 1));
+			break;
+		}
+		case SLOG_TYPE_FLOAT: {
+			if (c->end - c->p < 8) {
+				c->bad = true;
+				return;
+			}
+			uint64_t bits = 0;
+			for (int i = 0; i < 8; i++) {
+				bits |= (uint64_t)c->p[i] << (8 * i);
+			}
+			c->p += 8;
+			double v;
+			memcpy(&v, &bits, sizeof(v));
+			slog_write_double(v);
+			break;
+		}
+		case SLOG_TYPE_BOOL:
+			if (c->p >= c->end) {
+				c->bad = true;
+				return;
+			}
+			if (*c->p++) {
+				slog_buffer_append("true", 4);
+			} else {
+				slog_buffer_append("false", 5);
+			}
+			break;
+		case SLOG_TYPE_TIME: {
+			struct timespec ts;
+			ts.tv_sec = (time_t)read_varint(c);
+			ts.tv_nsec = (long)read_varint(c);
+			slog_write_time(&ts);
+			break;
+		}
+		case SLOG_TYPE_ARRAY:
+		case SLOG_TYPE_OBJECT:
+			if (depth == DECODE_DEPTH) {
+				c->bad = true;
+				return;
+			}
+			slog_buffer_putc(type == SLOG_TYPE_ARRAY ? '[' : '{');
+			decode_fields(s, c, depth + 1);
+			slog_buffer_putc(type == SLOG_TYPE_ARRAY ? ']' : '}');
+			break;
+		default:
+			c->bad = true;
+			return;
+		}
+	}
+}
+
+static bool decode_record(struct decode_stream *s, struct decode_cursor *c) {
+	const struct decode_def *site = def_get(s, read_varint(c));
+	struct timespec ts;
+	ts.tv_sec = (time_t)read_varint(c);
+	ts.tv_nsec = (long)read_varint(c);
+	const struct decode_def *msg = def_get(s, read_varint(c));
+	if (c->bad || !site || !site->file || !msg || !msg->str) {
+		return false;
+	}
+
+	slog_buffer.index = 0;
+	slog_buffer_putc('{');
+	write_key("file");
+	slog_write_escape(site->file);
+	slog_buffer_putc(',');
+	write_key("line");
+	slog_write_int(site->line);
+	slog_buffer_putc(',');
+	write_key("func");
+	slog_write_escape(site->func);
+	slog_buffer_putc(',');
+	write_key("level");
+	slog_write_escape(site->level);
+	slog_buffer_putc(',');
+	write_key("time");
+	slog_write_time(&ts);
+	slog_buffer_putc(',');
+	write_key("msg");
+	slog_write_escape_n(msg->str, msg->len);
+	if (c->p < c->end && *c->p) {
+		slog_buffer_putc(',');
+	}
+	decode_fields(s, c, 0);
+	slog_buffer_putc('}');
+	if (c->bad) {
+		return false;
+	}
+
+	fwrite(slog_buffer.data, 1, slog_buffer.index, stdout);
+	fputc('\n', stdout);
+	return true;
+}
+
+static bool decode_chunk(struct decode_stream *s, struct decode_cursor *c) {
+	while (c->p < c->end) {
+		const unsigned char tag = *c->p++;
+		struct decode_def *def;
+		switch (tag) {
+		case 'S':
+			def = def_new(s, read_varint(c), c);
+			if (!def) {
+				return false;
+			}
+			free(def->str);
+			def->str = dup_string(c);
+			def->len = def->str ? strlen(def->str) : 0;
+			break;
+		case 'C':
+			def = def_new(s, read_varint(c), c);
+			if (!def) {
+				return false;
+			}
+			def->line = (int)read_varint(c);
+			free(def->file);
+			free(def->func);
+			free(def->level);
+			def->file = dup_string(c);
+			def->func = dup_string(c);
+			def->level = dup_string(c);
+			break;
+		case 'R':
+			if (!decode_record(s, c)) {
+				return false;
+			}
+			break;
+		default:
+			return false;
+		}
+		if (c->bad) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t read_u32le(const unsigned char *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+	       (uint32_t)p[3] << 24;
+}
+
+int main(int argc, char **argv) {
+	FILE *in = stdin;
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [FILE]\n", argv[0]);
+		return 2;
+	}
+	if (argc == 2 && !(in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	int status = 0;
+	unsigned char header[SLOG_BINARY_HEADER];
+	unsigned char *payload = NULL;
+	size_t payload_size = 0;
+	size_t n;
+	while ((n = fread(header, 1, sizeof(header), in)) == sizeof(header)) {
+		if (memcmp(header, SLOG_BINARY_MAGIC, 4) != 0) {
+			fprintf(stderr, "not a slog binary chunk\n");
+			status = 1;
+			break;
+		}
+		const size_t len = read_u32le(header + 8);
+		if (len > payload_size) {
+			unsigned char *grown = (unsigned char *)realloc(payload, len);
+			if (!grown) {
+				status = 1;
+				break;
+			}
+			payload = grown;
+			payload_size = len;
+		}
+		if (fread(payload, 1, len, in) != len) {
+			fprintf(stderr, "truncated chunk\n");
+			status = 1;
+			break;
+		}
+
+		struct decode_stream *s = stream_get(read_u32le(header + 4));
+		struct decode_cursor c = {payload, payload + len, false};
+		if (!s || !decode_chunk(s, &c)) {
+			fprintf(stderr, "corrupt chunk\n");
+			status = 1;
+		}
+	}
+	if (n != 0 && n != sizeof(header)) {
+		fprintf(stderr, "truncated chunk\n");
+		status = 1;
+	}
+
+	for (size_t i = 0; i < stream_count; i++) {
+		for (size_t j = 0; j < streams[i].count; j++) {
+			free(streams[i].defs[j].str);
+			free(streams[i].defs[j].file);
+			free(streams[i].defs[j].func);
+			free(streams[i].defs[j].level);
+		}
+		free(streams[i].defs);
+	}
+	free(streams);
+	free(payload);
+	if (in != stdin) {
+		fclose(in);
+	}
+	SLOG_FREE();
+	return status;
+}
@@ -0,0 +1,48 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+// Prints the records left in a ring file written by slog_ring.h, oldest
+// first, one per line. Works on the file of a crashed or running process.
+//
+//   slog-ring FILE
+
+#include "slog_ring.h"
+
+static void print_record(const char *record, size_t len, void *arg) {
+	(void)arg;
+	fwrite(record, 1, len, stdout);
+	putchar('\n');
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s FILE\n", argv[0]);
+		return 2;
+	}
+	const int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	void *map = st.st_size ? mmap(NULL, (size_t)st.st_size, PROT_READ,
+				      MAP_SHARED, fd, 0)
+			       : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "not a slog ring file\n");
+		return 1;
+	}
+
+	const long count =
+		slog_ring_replay(map, (size_t)st.st_size, print_record, NULL);
+	munmap(map, (size_t)st.st_size);
+	if (count < 0) {
+		fprintf(stderr, "not a slog ring file\n");
+		return 1;
+	}
+	return 0;
+}